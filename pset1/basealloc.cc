@@ -2,6 +2,8 @@
 #include "m61.hh"
 #include <unordered_map>
 #include <vector>
+#include <mutex>
+#include <atomic>
 #include <sys/mman.h>
 
 
@@ -13,9 +15,13 @@ using base_allocation = std::pair<uintptr_t, size_t>;
 
 // `allocs` is a hash table mapping active pointer address to allocation size.
 // `frees` is a vector of freed allocations.
+// `base_lock` protects both; `disabled` is set by `base_allocator_disable`,
+// and `nested` guards against reentry from the same thread.
 static std::unordered_map<uintptr_t, size_t> allocs;
 static std::vector<base_allocation> frees;
-static int disabled;
+static std::mutex base_lock;
+static std::atomic<bool> disabled;
+static thread_local int nested;
 
 static unsigned alloc_random() {
     static uint64_t x = 8973443640547502487ULL;
@@ -26,10 +32,11 @@ static unsigned alloc_random() {
 static void base_allocator_atexit();
 
 void* base_malloc(size_t sz) {
-    if (disabled) {
+    if (disabled || nested) {
         return malloc(sz);
     }
-    ++disabled;
+    ++nested;
+    std::unique_lock<std::mutex> guard(base_lock);
     uintptr_t ptr = 0;
 
     static int base_alloc_atexit_installed = 0;
@@ -61,16 +68,18 @@ void* base_malloc(size_t sz) {
         allocs[reinterpret_cast<uintptr_t>(ptr)] = sz;
     }
 
-    --disabled;
+    guard.unlock();
+    --nested;
     return reinterpret_cast<void*>(ptr);
 }
 
 void base_free(void* ptr) {
-    if (disabled || !ptr) {
+    if (disabled || nested || !ptr) {
         free(ptr);
     } else {
         // mark free if found; if not found, complain about invalid free
-        ++disabled;
+        ++nested;
+        std::unique_lock<std::mutex> guard(base_lock);
         auto it = allocs.find(reinterpret_cast<uintptr_t>(ptr));
         if (it != allocs.end()) {
             frees.push_back(*it);
@@ -79,7 +88,8 @@ void base_free(void* ptr) {
             fprintf(stderr, "ERROR: invalid base_free of %p at %p\n", ptr,
                     __builtin_extract_return_addr(__builtin_return_address(0)));
         }
-        --disabled;
+        guard.unlock();
+        --nested;
     }
 }
 
@@ -88,6 +98,7 @@ void base_allocator_disable(bool d) {
 }
 
 static void base_allocator_atexit() {
+    std::lock_guard<std::mutex> guard(base_lock);
     // clean up freed memory to calm system leak detector
     for (auto& alloc : frees) {
         free(reinterpret_cast<void*>(alloc.first));
@@ -1,4 +1,5 @@
 #include "m61.hh"
+#include "m61hh.hh"
 #include <cstdlib>
 #include <cmath>
 #include <cstring>
@@ -32,9 +33,13 @@ size_t allocation_sizes[NALLOCATORS] = {
     1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
     1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
     1, 1, 1, 1, 2, 4, 8, 16, 32, 64,
-    128, 256, 512, 1024, 2048, 4096, 8192, 16384, 20000, 24000
+    128, 256, 512, 1024, 2048, 4096, 8192, 10000, 12000, 14000
 };
 
+// Number of times each allocation function was called (ground truth for
+// checking the heavy-hitter summary).
+unsigned long long ncalls[NALLOCATORS];
+
 static void phase(double skew, unsigned long long count) {
     // Calculate the probability we'll call allocator I.
     // That probability equals  2^(-I*skew) / \sum_{i=0}^40 2^(-I*skew).
@@ -65,19 +70,145 @@ static void phase(double skew, unsigned long long count) {
             ++r;
         }
         allocators[r]();
+        ++ncalls[r];
+    }
+}
+
+// Allocation site of each allocation function, found by `calibrate`.
+const char* site_file[NALLOCATORS];
+long site_line[NALLOCATORS];
+
+static void calibrate() {
+    // Call allocator I exactly I+1 times. No other sites have allocated
+    // yet and there are fewer sites than the summary tracks, so the
+    // summary is exact: the site with count I+1 belongs to allocator I.
+    for (int i = 0; i < NALLOCATORS; ++i) {
+        for (int j = 0; j <= i; ++j) {
+            allocators[i]();
+            ++ncalls[i];
+        }
+    }
+    static m61_heavy_hitter_summary hs;
+    m61_get_heavy_hitters(&hs, false);
+    for (size_t k = 0; k != hs.n; ++k) {
+        unsigned long long i = hs.hh[k].weight - 1;
+        if (hs.hh[k].error == 0 && i < NALLOCATORS && !site_file[i]) {
+            site_file[i] = hs.hh[k].file;
+            site_line[i] = hs.hh[k].line;
+        }
+    }
+    for (int i = 0; i < NALLOCATORS; ++i) {
+        if (!site_file[i]) {
+            fprintf(stderr, "calibration failed: no site for allocator %d\n", i);
+            exit(1);
+        }
     }
 }
 
+// Compare the heavy-hitter summary against exact counts. Returns the
+// number of violated bounds.
+static int check(bool by_size) {
+    static m61_heavy_hitter_summary hs;
+    m61_get_heavy_hitters(&hs, by_size);
+    unsigned long long truth[NALLOCATORS], total = 0;
+    for (int i = 0; i < NALLOCATORS; ++i) {
+        truth[i] = ncalls[i] * (by_size ? allocation_sizes[i] : 1);
+        total += truth[i];
+    }
+    const char* unit = by_size ? "bytes" : "allocations";
+
+    int nbad = 0;
+    double max_error = 0;
+    bool tracked[NALLOCATORS] = {};
+    for (size_t k = 0; k != hs.n; ++k) {
+        const m61_heavy_hitter& hh = hs.hh[k];
+        int i = 0;
+        while (i < NALLOCATORS
+               && (site_line[i] != hh.line || strcmp(site_file[i], hh.file) != 0)) {
+            ++i;
+        }
+        if (i == NALLOCATORS) {
+            continue;
+        }
+        tracked[i] = true;
+        if (truth[i] > hh.weight || truth[i] < hh.weight - hh.error) {
+            printf("CHECK FAILED: %s:%ld: %llu %s, reported %llu (error %llu)\n",
+                   hh.file, hh.line, truth[i], unit, hh.weight, hh.error);
+            ++nbad;
+        }
+        if (hh.weight - truth[i] > max_error) {
+            max_error = hh.weight - truth[i];
+        }
+    }
+    for (int i = 0; i < NALLOCATORS; ++i) {
+        if (!tracked[i] && truth[i] > hs.floor) {
+            printf("CHECK FAILED: %s:%ld: %llu %s, above floor %llu but untracked\n",
+                   site_file[i], site_line[i], truth[i], unit, hs.floor);
+            ++nbad;
+        }
+    }
+    printf("CHECK %s: %s: max overestimate %.4f%%, bound %.4f%%\n",
+           nbad ? "FAILED" : "OK", unit, 100.0 * max_error / total,
+           100.0 / M61_HH_CAPACITY);
+    return nbad;
+}
+
+// Check that merging summaries in which one site appears under two
+// file-name addresses on each side sums all four histograms. Returns the
+// number of violated expectations.
+static int check_merge() {
+    static char file1[] = "merged.cc", file2[] = "merged.cc",
+        file3[] = "merged.cc", file4[] = "merged.cc";
+    static m61_hh_summary a, b;
+    static m61_heavy_hitter_summary hs;
+    a.add(file1, 7, 10, 3);
+    a.add(file2, 7, 20, 4);
+    a.add_lifetime(file1, 7, 1);
+    a.add_lifetime(file2, 7, 2);
+    b.add(file3, 7, 40, 4);
+    b.add(file4, 7, 80, 5);
+    b.add_lifetime(file3, 7, 2);
+    b.add_lifetime(file4, 7, 3);
+    a.merge(b);
+    a.get(&hs);
+
+    int nbad = 0;
+    if (hs.n != 1 || strcmp(hs.hh[0].file, "merged.cc") != 0 || hs.hh[0].line != 7
+        || hs.hh[0].weight != 150) {
+        printf("CHECK FAILED: merge: expected one site merged.cc:7 weighing 150\n");
+        return 1;
+    }
+    unsigned size_expected[] = {0, 0, 0, 1, 2, 1}, lifetime_expected[] = {0, 1, 2, 1};
+    for (int i = 0; i != M61_HH_NBUCKETS; ++i) {
+        unsigned size_n = i < 6 ? size_expected[i] : 0;
+        unsigned lifetime_n = i < 4 ? lifetime_expected[i] : 0;
+        if (hs.hh[0].size_hist[i] != size_n || hs.hh[0].lifetime_hist[i] != lifetime_n) {
+            printf("CHECK FAILED: merge: bucket %d has %llu sizes and %llu lifetimes, "
+                   "expected %u and %u\n", i, hs.hh[0].size_hist[i],
+                   hs.hh[0].lifetime_hist[i], size_n, lifetime_n);
+            ++nbad;
+        }
+    }
+    printf("CHECK %s: merge\n", nbad ? "FAILED" : "OK");
+    return nbad;
+}
+
 int main(int argc, char **argv) {
     // use the system allocator, not the base allocator
     // (the base allocator can be slow)
     base_allocator_disable(1);
 
+    bool checking = argc > 1 && strcmp(argv[1], "-c") == 0;
+    if (checking) {
+        --argc, ++argv;
+        calibrate();
+    }
+
     if (argc > 1 && (strcmp(argv[1], "-h") == 0
                      || strcmp(argv[1], "--help") == 0)) {
-        printf("Usage: ./hhtest\n\
-       OR ./hhtest SKEW [COUNT]\n\
-       OR ./hhtest SKEW1 COUNT1 SKEW2 COUNT2 ...\n\
+        printf("Usage: ./hhtest [-c]\n\
+       OR ./hhtest [-c] SKEW [COUNT]\n\
+       OR ./hhtest [-c] SKEW1 COUNT1 SKEW2 COUNT2 ...\n\
 \n\
   Each SKEW is a real number. 0 means each allocator is called equally\n\
   frequently. 1 means the first allocator is called twice as much as the\n\
@@ -87,7 +218,11 @@ int main(int argc, char **argv) {
   The default is 1000000.\n\
 \n\
   If you give multiple SKEW COUNT pairs, then ./hhtest runs several\n\
-  allocation phases in order.\n");
+  allocation phases in order.\n\
+\n\
+  With -c, ./hhtest also checks the heavy-hitter summary against exact\n\
+  per-site counts, and that merging summaries adds up a site's histograms,\n\
+  and exits with status 1 if any check fails.\n");
         exit(0);
     }
 
@@ -107,4 +242,7 @@ int main(int argc, char **argv) {
     }
 
     m61_print_heavy_hitter_report();
+    if (checking && check(true) + check(false) + check_merge() != 0) {
+        exit(1);
+    }
 }
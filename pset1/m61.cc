@@ -1,10 +1,1839 @@
 #define M61_DISABLE 1
 #include "m61.hh"
+#include "m61hh.hh"
+#include "m61stack.hh"
+#include "m61trace.hh"
+#include "m61export.hh"
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 #include <cstdio>
 #include <cinttypes>
 #include <cassert>
+#include <cmath>
+#include <ctime>
+#include <atomic>
+#include <mutex>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <climits>
+#include <csignal>
+#include <new>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include <fcntl.h>
+#include <link.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// m61 heap organization
+//    m61 gets memory from the base allocator in large *chunks*, which are
+//    divided into 4096-byte pages. A run of consecutive pages is a *span*.
+//    Every span is either free, a *slab* holding equal-sized objects of a
+//    single size class, one *large* allocation, or a block of an *arena*.
+//    Allocations of at least `mmap_threshold` bytes instead get *mapped*
+//    spans, each its own `mmap` region outside any chunk. The *pagemap*
+//    maps every page of every span to that span, so `m61_free` finds a
+//    pointer's span without touching user memory.
+//
+// Threads
+//    Each thread caches free objects of every size class in a `tcache`, so
+//    most allocations and frees take no lock. Caches refill from and drain
+//    to the shared slabs in batches of `batch_objects` objects, under a
+//    per-class `central` lock. The page heap has a single lock, always
+//    acquired after any central lock.
+//
+// Tracking
+//    By default every allocation records its site (`file`:`line`), which
+//    feeds the heavy-hitter and leak reports. Setting the environment
+//    variable `M61_SAMPLE=N` instead tracks a sample of about one
+//    allocation per N bytes, and reports scale the samples back up into
+//    estimates. Statistics are always exact.
+
+static constexpr unsigned page_shift = 12;
+static constexpr size_t page_size = size_t(1) << page_shift;
+static constexpr size_t chunk_size = size_t(1) << 20;
+
+// Requests larger than `max_alloc_size` fail without asking for memory.
+static constexpr size_t max_alloc_size = size_t(1) << 46;
+
+
+// Size classes
+//    Small requests (<= `max_small_size` bytes) are rounded up to one of
+//    `nclasses` size classes: multiples of 16 up to 128, then four classes
+//    per power of two. Each class is served from slabs of `slab_pages`
+//    pages. The table is computed at compile time.
+
+static constexpr size_t max_small_size = 32768;
+static constexpr int nclasses = 40;
+
+struct size_class_table {
+    size_t size[nclasses];             // object size
+    size_t slab_pages[nclasses];       // # pages per slab
+    unsigned slab_objects[nclasses];   // # objects per slab
+    unsigned batch_objects[nclasses];  // # objects moved per tcache refill
+    uint64_t div_magic[nclasses];      // `(off * div_magic) >> 40 == off / size`
+    uint8_t index16[1024 / 16 + 1];    // class for sizes <= 1024, by 16s
+    uint8_t index128[max_small_size / 128 + 1]; // class for larger, by 128s
+
+    constexpr size_class_table()
+        : size(), slab_pages(), slab_objects(), batch_objects(), div_magic(),
+          index16(), index128() {
+        int c = 0;
+        for (size_t sz = 16; sz <= 128; sz += 16) {
+            size[c++] = sz;
+        }
+        for (size_t p = 128; p < max_small_size; p *= 2) {
+            for (size_t i = 1; i <= 4; ++i) {
+                size[c++] = p + i * (p / 4);
+            }
+        }
+        // A slab is at least 4 pages and holds at least 8 objects; grow
+        // it until less than 1/8 of it is wasted at the end.
+        for (c = 0; c != nclasses; ++c) {
+            size_t bytes = 8 * size[c] > 4 * page_size ? 8 * size[c] : 4 * page_size;
+            size_t npages = (bytes + page_size - 1) / page_size;
+            while ((npages * page_size) % size[c] > npages * page_size / 8) {
+                ++npages;
+            }
+            slab_pages[c] = npages;
+            slab_objects[c] = npages * page_size / size[c];
+            // Move about 32 KiB per batch, but between 2 and 32 objects.
+            size_t batch = 32768 / size[c];
+            batch_objects[c] = batch < 2 ? 2 : (batch > 32 ? 32 : batch);
+            // Exact for offsets below 2^40 / size, which covers any slab.
+            div_magic[c] = ((uint64_t(1) << 40) + size[c] - 1) / size[c];
+        }
+        c = 0;
+        for (size_t i = 0; i != sizeof(index16); ++i) {
+            while (size[c] < i * 16) {
+                ++c;
+            }
+            index16[i] = c;
+        }
+        c = 0;
+        for (size_t i = 0; i != sizeof(index128); ++i) {
+            while (size[c] < i * 128) {
+                ++c;
+            }
+            index128[i] = c;
+        }
+    }
+};
+
+static constexpr size_class_table classes;
+static_assert(classes.size[nclasses - 1] == max_small_size,
+              "size class table must end at max_small_size");
+static_assert(nclasses == M61_NCLASSES, "M61_NCLASSES must match");
+
+static inline int size_class(size_t sz) {
+    if (sz <= 1024) {
+        return classes.index16[(sz + 15) >> 4];
+    } else {
+        return classes.index128[(sz + 127) >> 7];
+    }
+}
+
+// aligned_size_class(sz, align)
+//    Return the smallest size class holding `sz` bytes whose size is a
+//    multiple of `align`, or -1 if none is. Slabs start on page
+//    boundaries, so every object in such a class is `align`-aligned if
+//    `align <= page_size`.
+static int aligned_size_class(size_t sz, size_t align) {
+    if (align <= page_size) {
+        for (int sc = size_class(sz); sc != nclasses; ++sc) {
+            if (classes.size[sc] % align == 0) {
+                return sc;
+            }
+        }
+    }
+    return -1;
+}
+
+
+// Spans
+//    Each slab has a side array, `info`, holding an `m61_blockinfo` for
+//    each of its objects, and a bitmap, `allocated`, whose bit `i` is set
+//    while object `i` is allocated. Large spans hold the same information
+//    directly. Arena objects are preceded by an `m61_arena_header`. Spans
+//    never cross chunk boundaries.
+
+struct m61_blockinfo {
+    const char* file;           // allocation site, or nullptr if untracked
+    uint32_t line;
+    uint32_t size;              // requested size
+    uint32_t tick;              // `alloc_ticks` when allocated
+    uint32_t pad;               // lead bytes beyond `redzone_lead` (aligned only)
+};
+
+// A slot's `info` is all ones until the slot is first allocated.
+static inline bool block_never_allocated(const m61_blockinfo& info) {
+    return reinterpret_cast<uintptr_t>(info.file) == UINTPTR_MAX;
+}
+
+struct m61_arena_header {
+    const char* file;           // allocation site
+    uint32_t line;
+    uint32_t size;              // requested size
+};
+
+// Return the arena space used by an object of `sz` bytes.
+static inline size_t arena_need(size_t sz) {
+    return sizeof(m61_arena_header) + ((sz ? sz : 1) + 15) / 16 * 16;
+}
+
+enum span_state : uint8_t {
+    span_free = 0, span_slab = 1, span_large = 2, span_arena = 3,
+    span_mapped = 4, span_unmapping = 5, span_quarantined = 6
+};
+
+struct m61_span {
+    uintptr_t first;            // address of first page
+    size_t npages;              // number of pages
+    m61_span* prev;             // links in a free bin or size-class list
+    m61_span* next;
+    span_state state;
+    uint8_t sizeclass;          // size class (slabs only)
+    unsigned nfree;             // # free objects (slabs only)
+    void* freelist;             // freed objects (slabs only)
+    uintptr_t bump;             // first never-used byte (slabs and arenas)
+    m61_blockinfo* info;        // per-object metadata (slabs only)
+    std::atomic<uint64_t>* allocated;   // allocated-object bits (ditto)
+    std::atomic<uint64_t>* marked;      // reachable-object bits (ditto)
+    size_t size;                // requested size (large and mapped spans)
+    uint32_t pad;               // lead bytes beyond `redzone_lead` (ditto)
+    const char* file;           // allocation site (large and mapped spans)
+    long line;
+    uint32_t tick;              // `alloc_ticks` when allocated (ditto)
+    unsigned chunk;             // index of containing chunk (not mapped spans)
+    bool scavenged;             // pages released to the OS (free spans only)
+    bool zeroed;                // all pages known to be zero (free spans only)
+    uint64_t freed_at;          // time freed, in ns (free spans only)
+    std::atomic<bool> reached;  // marked reachable (large and mapped spans)
+
+    uintptr_t last() const {
+        return first + (npages << page_shift);
+    }
+    // Return the index of the slab object containing `addr`. Addresses in
+    // the slab's tail, past its last object, return an index that fails
+    // `is_object`; check it before touching `info` or the bitmaps.
+    unsigned index(uintptr_t addr) const {
+        return ((addr - first) * classes.div_magic[sizeclass]) >> 40;
+    }
+    // Return true if `i` is the index of one of this slab's objects.
+    bool is_object(unsigned i) const {
+        return i < classes.slab_objects[sizeclass];
+    }
+    // Return true if slab object `i` is allocated.
+    bool is_allocated(unsigned i) const {
+        return (allocated[i / 64].load(std::memory_order_relaxed) >> (i % 64)) & 1;
+    }
+};
+
+// Span lists are circular and doubly linked, with a dummy head span.
+
+static inline void list_init(m61_span* head) {
+    head->prev = head->next = head;
+}
+
+static inline bool list_empty(const m61_span* head) {
+    return head->next == head;
+}
+
+static inline void list_push(m61_span* head, m61_span* s) {
+    s->next = head->next;
+    s->prev = head;
+    head->next->prev = s;
+    head->next = s;
+}
+
+static inline void list_remove(m61_span* s) {
+    s->prev->next = s->next;
+    s->next->prev = s->prev;
+    s->prev = s->next = nullptr;
+}
+
+
+// Metadata memory
+//    Span descriptors and pagemap nodes live in blocks obtained from the
+//    base allocator, never in chunk pages.
+
+static void* meta_alloc(size_t sz) {
+    static char* meta_next;
+    static size_t meta_left;
+    sz = (sz + 15) & ~size_t(15);
+    if (sz > meta_left) {
+        size_t block_size = sz > 65536 ? sz : 65536;
+        meta_next = reinterpret_cast<char*>(base_malloc(block_size));
+        if (!meta_next) {
+            fprintf(stderr, "m61: out of metadata memory\n");
+            abort();
+        }
+        meta_left = block_size;
+    }
+    void* ptr = meta_next;
+    meta_next += sz;
+    meta_left -= sz;
+    memset(ptr, 0, sz);
+    return ptr;
+}
+
+static m61_span* span_freelist;
+
+static m61_span* span_new(uintptr_t first, size_t npages) {
+    m61_span* s = span_freelist;
+    if (s) {
+        span_freelist = s->next;
+    } else {
+        s = reinterpret_cast<m61_span*>(meta_alloc(sizeof(m61_span)));
+    }
+    s = new (s) m61_span{};
+    s->first = first;
+    s->npages = npages;
+    return s;
+}
+
+static void span_delete(m61_span* s) {
+    s->next = span_freelist;
+    span_freelist = s;
+}
+
+
+// Pagemap
+//    A three-level radix tree indexed by the 36-bit page number of a
+//    48-bit address. Interior nodes are allocated on demand and never
+//    freed. Every page of every span maps to that span. Entries are
+//    written under the page heap lock, but read without any lock.
+
+static constexpr unsigned pagemap_bits = 12;
+static constexpr size_t pagemap_fanout = size_t(1) << pagemap_bits;
+
+struct pagemap_leaf {
+    std::atomic<m61_span*> span[pagemap_fanout];
+};
+struct pagemap_node {
+    std::atomic<pagemap_leaf*> leaf[pagemap_fanout];
+};
+static std::atomic<pagemap_node*> pagemap_root[pagemap_fanout];
+
+static inline m61_span* pagemap_get(uintptr_t addr) {
+    uintptr_t pn = addr >> page_shift;
+    if (pn >> (3 * pagemap_bits)) {
+        return nullptr;
+    }
+    pagemap_node* node = pagemap_root[pn >> (2 * pagemap_bits)]
+        .load(std::memory_order_acquire);
+    if (!node) {
+        return nullptr;
+    }
+    pagemap_leaf* leaf = node->leaf[(pn >> pagemap_bits) & (pagemap_fanout - 1)]
+        .load(std::memory_order_acquire);
+    if (!leaf) {
+        return nullptr;
+    }
+    return leaf->span[pn & (pagemap_fanout - 1)].load(std::memory_order_acquire);
+}
+
+static void pagemap_set(uintptr_t first, size_t npages, m61_span* s) {
+    uintptr_t pn = first >> page_shift;
+    for (uintptr_t end = pn + npages; pn != end; ++pn) {
+        assert(!(pn >> (3 * pagemap_bits)));
+        auto& rootp = pagemap_root[pn >> (2 * pagemap_bits)];
+        pagemap_node* node = rootp.load(std::memory_order_relaxed);
+        if (!node) {
+            node = reinterpret_cast<pagemap_node*>(meta_alloc(sizeof(pagemap_node)));
+            rootp.store(node, std::memory_order_release);
+        }
+        auto& nodep = node->leaf[(pn >> pagemap_bits) & (pagemap_fanout - 1)];
+        pagemap_leaf* leaf = nodep.load(std::memory_order_relaxed);
+        if (!leaf) {
+            leaf = reinterpret_cast<pagemap_leaf*>(meta_alloc(sizeof(pagemap_leaf)));
+            nodep.store(leaf, std::memory_order_release);
+        }
+        leaf->span[pn & (pagemap_fanout - 1)].store(s, std::memory_order_release);
+    }
+}
+
+
+// Page heap
+//    Free spans of fewer than `nfreebins` pages live in `free_bins[npages]`;
+//    bigger free spans live in `free_bins[0]`. Adjacent free spans are
+//    coalesced. Callers of `pageheap_*` functions must hold `pageheap_lock`,
+//    which also protects metadata memory.
+
+static constexpr size_t nfreebins = 128;
+static m61_span free_bins[nfreebins];
+static std::mutex pageheap_lock;
+
+struct m61_chunk {
+    uintptr_t first;            // address of first page
+    size_t npages;              // number of pages
+};
+static m61_chunk* chunks;
+static size_t nchunks;
+static size_t chunks_capacity;
+static unsigned scans_active;       // # `m61_find_unreachable` scans running
+
+static uint64_t scavenge_age;       // 0 means never scavenge
+static uint64_t scavenge_last;
+static std::atomic<unsigned long long> scavenged_bytes;
+
+static void pageheap_init() {
+    static bool initialized;
+    if (!initialized) {
+        for (auto& bin : free_bins) {
+            list_init(&bin);
+        }
+        initialized = true;
+    }
+}
+
+static inline m61_span* free_bin(size_t npages) {
+    return &free_bins[npages < nfreebins ? npages : 0];
+}
+
+static inline uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+// pageheap_coalesce(s)
+//    Merge the free span `s`, which is in no free bin, with its free
+//    neighbors in the same chunk whose pages are in the same released
+//    state, so a span's `scavenged` flag covers all of its pages.
+static void pageheap_coalesce(m61_span* s) {
+    m61_span* left = pagemap_get(s->first - page_size);
+    if (left && left->state == span_free && left->chunk == s->chunk
+        && left->scavenged == s->scavenged) {
+        list_remove(left);
+        s->first = left->first;
+        s->npages += left->npages;
+        s->zeroed = s->zeroed && left->zeroed;
+        span_delete(left);
+    }
+    m61_span* right = pagemap_get(s->last());
+    if (right && right->state == span_free && right->chunk == s->chunk
+        && right->scavenged == s->scavenged) {
+        list_remove(right);
+        s->npages += right->npages;
+        s->zeroed = s->zeroed && right->zeroed;
+        span_delete(right);
+    }
+    pagemap_set(s->first, s->npages, s);
+}
+
+// pageheap_scavenge()
+//    If scavenging is on and `scavenge_age` has passed since the last
+//    scavenge, release the pages of every free span that has been free for
+//    at least `scavenge_age` to the OS. Released spans coalesce with their
+//    released neighbors and stay in the free bins; their pages read as
+//    zero and are faulted back in when reused. Called on page heap
+//    operations, so an idle program is not scavenged.
+static void pageheap_scavenge() {
+    if (!scavenge_age) {
+        return;
+    }
+    uint64_t now = now_ns();
+    if (now - scavenge_last < scavenge_age) {
+        return;
+    }
+    scavenge_last = now;
+    // unlink the spans first, since coalescing changes the bins
+    m61_span* idle = nullptr;
+    for (auto& bin : free_bins) {
+        for (m61_span* s = bin.next, *next; s != &bin; s = next) {
+            next = s->next;
+            if (!s->scavenged && now - s->freed_at >= scavenge_age) {
+                list_remove(s);
+                s->next = idle;
+                idle = s;
+            }
+        }
+    }
+    while (m61_span* s = idle) {
+        idle = s->next;
+        madvise(reinterpret_cast<void*>(s->first), s->npages << page_shift,
+                MADV_DONTNEED);
+        s->scavenged = true;
+        s->zeroed = true;
+        scavenged_bytes.fetch_add(s->npages << page_shift,
+                                  std::memory_order_relaxed);
+        pageheap_coalesce(s);
+        list_push(free_bin(s->npages), s);
+    }
+}
+
+// pageheap_release(s, zeroed)
+//    Mark `s` free, coalesce it with free neighbors that have not been
+//    released to the OS, and put the result in its free bin. `zeroed`
+//    says whether all of `s`'s pages are zero.
+static void pageheap_release(m61_span* s, bool zeroed = false) {
+    s->state = span_free;
+    s->freelist = nullptr;
+    s->scavenged = false;
+    s->zeroed = zeroed;
+    s->freed_at = scavenge_age ? now_ns() : 0;
+    pageheap_coalesce(s);
+    list_push(free_bin(s->npages), s);
+    pageheap_scavenge();
+}
+
+// pageheap_grow(npages)
+//    Add a chunk of at least `npages` pages to the page heap. Returns false
+//    if the base allocator is out of memory.
+static bool pageheap_grow(size_t npages) {
+    size_t chunk_pages = npages > (chunk_size >> page_shift)
+        ? npages : chunk_size >> page_shift;
+    void* raw = base_malloc((chunk_pages << page_shift) + page_size);
+    if (!raw) {
+        return false;
+    }
+    if (nchunks == chunks_capacity) {
+        size_t ncap = chunks_capacity ? chunks_capacity * 2 : 64;
+        auto nc = reinterpret_cast<m61_chunk*>(meta_alloc(ncap * sizeof(m61_chunk)));
+        if (nchunks) {
+            memcpy(nc, chunks, nchunks * sizeof(m61_chunk));
+        }
+        chunks = nc;
+        chunks_capacity = ncap;
+    }
+    uintptr_t first = (reinterpret_cast<uintptr_t>(raw) + page_size - 1)
+        & ~(page_size - 1);
+    // Drop the chunk's pages, so they are known to read as zero. This is
+    // nearly free for the fresh mappings that back most chunks.
+    madvise(reinterpret_cast<void*>(first), chunk_pages << page_shift, MADV_DONTNEED);
+    m61_span* s = span_new(first, chunk_pages);
+    s->chunk = nchunks;
+    chunks[nchunks++] = {first, chunk_pages};
+    pageheap_release(s, true);
+    return true;
+}
+
+// pageheap_alloc(npages)
+//    Return a span of exactly `npages` pages, or nullptr if out of memory.
+//    Uses the smallest free span that fits.
+static m61_span* pageheap_alloc(size_t npages) {
+    pageheap_init();
+    m61_span* s = nullptr;
+    while (!s) {
+        for (size_t n = npages; n < nfreebins && !s; ++n) {
+            if (!list_empty(&free_bins[n])) {
+                s = free_bins[n].next;
+            }
+        }
+        for (m61_span* t = free_bins[0].next; !s && t != &free_bins[0]; t = t->next) {
+            if (t->npages >= npages && (!s || t->npages < s->npages)) {
+                s = t;
+            }
+        }
+        if (!s && !pageheap_grow(npages)) {
+            return nullptr;
+        }
+    }
+    list_remove(s);
+    if (s->npages > npages) {
+        m61_span* rest = span_new(s->first + (npages << page_shift),
+                                  s->npages - npages);
+        rest->state = span_free;
+        rest->chunk = s->chunk;
+        rest->scavenged = s->scavenged;
+        rest->zeroed = s->zeroed;
+        rest->freed_at = s->freed_at;
+        pagemap_set(rest->first, rest->npages, rest);
+        list_push(free_bin(rest->npages), rest);
+        s->npages = npages;
+    }
+    pagemap_set(s->first, s->npages, s);
+    pageheap_scavenge();
+    return s;
+}
+
+// pageheap_trim(s, npages, zeroed)
+//    Shrink the allocated span `s` to its first `npages` pages, returning
+//    the rest to the free bins. `zeroed` says whether the rest is zero.
+static void pageheap_trim(m61_span* s, size_t npages, bool zeroed = false) {
+    if (s->npages > npages) {
+        m61_span* tail = span_new(s->first + (npages << page_shift),
+                                  s->npages - npages);
+        tail->chunk = s->chunk;
+        s->npages = npages;
+        pagemap_set(tail->first, tail->npages, tail);
+        pageheap_release(tail, zeroed);
+    }
+}
+
+// pageheap_alloc_aligned(npages, align)
+//    Return a span of exactly `npages` pages that starts at a multiple of
+//    `align`, a power of two larger than a page, or nullptr if out of
+//    memory. The pages skipped to reach alignment return to the free bins.
+static m61_span* pageheap_alloc_aligned(size_t npages, size_t align) {
+    m61_span* s = pageheap_alloc(npages + (align >> page_shift) - 1);
+    if (!s) {
+        return nullptr;
+    }
+    s->state = span_large;
+    uintptr_t first = (s->first + align - 1) & ~(align - 1);
+    if (first != s->first) {
+        m61_span* head = span_new(s->first, (first - s->first) >> page_shift);
+        head->chunk = s->chunk;
+        s->first = first;
+        s->npages -= head->npages;
+        pagemap_set(head->first, head->npages, head);
+        pageheap_release(head, s->zeroed);
+    }
+    pageheap_trim(s, npages, s->zeroed);
+    return s;
+}
+
+// pageheap_extend(s, npages)
+//    Grow the allocated span `s` in place to `npages` pages, taking pages
+//    from the free span that follows it. Returns false if there is no such
+//    span or it is too small.
+static bool pageheap_extend(m61_span* s, size_t npages) {
+    size_t more = npages - s->npages;
+    m61_span* right = pagemap_get(s->last());
+    if (!right || right->state != span_free || right->chunk != s->chunk
+        || right->npages < more) {
+        return false;
+    }
+    list_remove(right);
+    if (right->npages > more) {
+        m61_span* rest = span_new(right->first + (more << page_shift),
+                                  right->npages - more);
+        rest->state = span_free;
+        rest->chunk = right->chunk;
+        rest->scavenged = right->scavenged;
+        rest->zeroed = right->zeroed;
+        rest->freed_at = right->freed_at;
+        pagemap_set(rest->first, rest->npages, rest);
+        list_push(free_bin(rest->npages), rest);
+    }
+    pagemap_set(right->first, more, s);
+    span_delete(right);
+    s->npages = npages;
+    return true;
+}
+
+
+// Mapped spans
+//    A mapped span is a private `mmap` region holding one allocation. Live
+//    mapped spans are listed in `mapped_spans`. A freed mapped span enters
+//    `unmapping_spans`, a short FIFO quarantine: its pages are replaced at
+//    once with inaccessible, empty ones, which returns its memory to the
+//    OS and makes later accesses fault, and it is unmapped once
+//    `max_unmapping` newer spans are freed. Until then, frees of it are
+//    recognized as double frees. Both lists are protected by
+//    `pageheap_lock`.
+
+static constexpr unsigned max_unmapping = 16;
+static m61_span mapped_spans;
+static m61_span unmapping_spans;
+static unsigned nunmapping;
+static std::atomic<unsigned long long> mapped_count;   // # live mapped spans
+static std::atomic<unsigned long long> mapped_bytes;   // # bytes in them
+
+// mapped_alloc(need, sz, file, line, tick, align, pad)
+//    Return a new mapped span of at least `need` bytes for an `sz`-byte
+//    allocation made at `tick`, starting at a multiple of `align`, or
+//    nullptr if out of memory. The block has `pad` extra lead bytes.
+static void* mapped_alloc(size_t need, size_t sz, const char* file, long line,
+                          uint32_t tick, size_t align, uint32_t pad) {
+    size_t len = (need + page_size - 1) & ~(page_size - 1);
+    size_t slack = align > page_size ? align - page_size : 0;
+    void* mem = mmap(nullptr, len + slack, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return nullptr;
+    }
+    uintptr_t first = reinterpret_cast<uintptr_t>(mem);
+    if (slack) {
+        uintptr_t aligned = (first + align - 1) & ~(align - 1);
+        if (aligned != first) {
+            munmap(mem, aligned - first);
+        }
+        if (first + slack != aligned) {
+            munmap(reinterpret_cast<void*>(aligned + len), first + slack - aligned);
+        }
+        first = aligned;
+        mem = reinterpret_cast<void*>(first);
+    }
+    std::lock_guard<std::mutex> guard(pageheap_lock);
+    if (!mapped_spans.next) {
+        list_init(&mapped_spans);
+        list_init(&unmapping_spans);
+    }
+    m61_span* s = span_new(first, len >> page_shift);
+    s->state = span_mapped;
+    s->size = sz;
+    s->pad = pad;
+    s->file = file;
+    s->line = line;
+    s->tick = tick;
+    s->chunk = UINT_MAX;
+    pagemap_set(first, s->npages, s);
+    list_push(&mapped_spans, s);
+    mapped_count.fetch_add(1, std::memory_order_relaxed);
+    mapped_bytes.fetch_add(len, std::memory_order_relaxed);
+    return mem;
+}
+
+// mapped_resize(s, need)
+//    Resize mapped span `s` to hold at least `need` bytes with `mremap`,
+//    which may move it. Returns false if out of memory.
+static bool mapped_resize(m61_span* s, size_t need) {
+    size_t len = (need + page_size - 1) & ~(page_size - 1);
+    size_t old_len = s->npages << page_shift;
+    if (len == old_len) {
+        return true;
+    }
+    std::lock_guard<std::mutex> guard(pageheap_lock);
+    void* mem = mremap(reinterpret_cast<void*>(s->first), old_len, len, MREMAP_MAYMOVE);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+    pagemap_set(s->first, s->npages, nullptr);
+    s->first = reinterpret_cast<uintptr_t>(mem);
+    s->npages = len >> page_shift;
+    pagemap_set(s->first, s->npages, s);
+    mapped_bytes.fetch_add(len - old_len, std::memory_order_relaxed);
+    return true;
+}
+
+static void mapped_free(m61_span* s) {
+    void* mem = reinterpret_cast<void*>(s->first);
+    size_t len = s->npages << page_shift;
+    void* victim = nullptr;
+    size_t victim_len = 0;
+    {
+        // a reachability scan reads live mapped spans under `pageheap_lock`
+        std::lock_guard<std::mutex> guard(pageheap_lock);
+        mmap(mem, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE,
+             -1, 0);
+        list_remove(s);
+        s->state = span_unmapping;
+        list_push(&unmapping_spans, s);
+        if (++nunmapping > max_unmapping) {
+            m61_span* v = unmapping_spans.prev;
+            list_remove(v);
+            --nunmapping;
+            victim = reinterpret_cast<void*>(v->first);
+            victim_len = v->npages << page_shift;
+            pagemap_set(v->first, v->npages, nullptr);
+            span_delete(v);
+        }
+    }
+    mapped_count.fetch_sub(1, std::memory_order_relaxed);
+    mapped_bytes.fetch_sub(len, std::memory_order_relaxed);
+    if (victim) {
+        munmap(victim, victim_len);
+    }
+}
+
+
+// Slabs
+//    `central[c].slabs` lists the slabs of class `c` that have free objects.
+//    Objects in a fresh slab are handed out by bumping `s->bump`, so slab
+//    pages are touched only when used; freed objects form a list threaded
+//    through their first word. (So do objects in thread caches.) The link
+//    is cleared when an object is allocated, so a stale link cannot make
+//    `m61_find_unreachable` think one block points to another. Slab
+//    functions require `central[c].lock`.
+//
+//    The `allocated` bits are not protected by that lock: objects pass
+//    through thread caches, so any thread may allocate or free any object.
+//    Bits are set and cleared with atomic read-modify-writes, so of two
+//    racing frees of one object, exactly one sees its bit set.
+
+struct alignas(64) m61_central {
+    std::mutex lock;
+    m61_span slabs{};
+};
+static m61_central central[nclasses];
+
+static m61_span* slab_create(int sc) {
+    // `info`, the `allocated` bits, and the `marked` bits share one
+    // metadata block
+    size_t info_size = classes.slab_objects[sc] * sizeof(m61_blockinfo);
+    size_t nwords = (classes.slab_objects[sc] + 63) / 64;
+    auto info = reinterpret_cast<m61_blockinfo*>(
+        base_malloc(info_size + 2 * nwords * sizeof(uint64_t))
+    );
+    if (!info) {
+        return nullptr;
+    }
+    memset(info, 0xFF, info_size);
+    auto allocated = reinterpret_cast<std::atomic<uint64_t>*>(
+        reinterpret_cast<char*>(info) + info_size
+    );
+    for (size_t w = 0; w != 2 * nwords; ++w) {
+        new (&allocated[w]) std::atomic<uint64_t>(0);
+    }
+    std::lock_guard<std::mutex> guard(pageheap_lock);
+    m61_span* s = pageheap_alloc(classes.slab_pages[sc]);
+    if (!s) {
+        base_free(info);
+        return nullptr;
+    }
+    s->info = info;
+    s->allocated = allocated;
+    s->marked = allocated + nwords;
+    s->state = span_slab;
+    s->sizeclass = sc;
+    s->nfree = classes.slab_objects[sc];
+    s->freelist = nullptr;
+    s->bump = s->first;
+    return s;
+}
+
+static void* slab_alloc(int sc) {
+    m61_span* head = &central[sc].slabs;
+    if (!head->next) {
+        list_init(head);
+    }
+    m61_span* s = head->next;
+    if (s == head) {
+        if (!(s = slab_create(sc))) {
+            return nullptr;
+        }
+        list_push(head, s);
+    }
+    void* ptr = s->freelist;
+    if (ptr) {
+        s->freelist = *reinterpret_cast<void**>(ptr);
+        *reinterpret_cast<void**>(ptr) = nullptr;
+    } else {
+        ptr = reinterpret_cast<void*>(s->bump);
+        s->bump += classes.size[sc];
+    }
+    if (--s->nfree == 0) {
+        list_remove(s);
+    }
+    return ptr;
+}
+
+static void slab_free(m61_span* s, void* ptr) {
+    int sc = s->sizeclass;
+    m61_span* head = &central[sc].slabs;
+    *reinterpret_cast<void**>(ptr) = s->freelist;
+    s->freelist = ptr;
+    ++s->nfree;
+    if (s->nfree == 1) {
+        list_push(head, s);
+    } else if (s->nfree == classes.slab_objects[sc]
+               && (head->next != s || s->next != head)) {
+        // entirely free, and not the class's only partial slab
+        m61_blockinfo* info = s->info;
+        {
+            // heap walks check slab `info` under `pageheap_lock`; a
+            // reachability scan uses slab metadata without it, so the slab
+            // stays while one runs
+            std::lock_guard<std::mutex> guard(pageheap_lock);
+            if (scans_active) {
+                return;
+            }
+            list_remove(s);
+            s->info = nullptr;
+            s->allocated = nullptr;
+            s->marked = nullptr;
+            pageheap_release(s);
+        }
+        base_free(info);
+    }
+}
+
+
+// Configuration
+//    Read from the environment by `config_init`, which runs under
+//    `threads_lock` when the first thread registers. Constant afterwards.
+//
+//    M61_SAMPLE=N    Track a sample of about one allocation per N bytes
+//                    rather than every allocation.
+//    M61_TRACE=FILE  Record every allocation and free in FILE. `%p` in
+//                    FILE stands for the process ID; libm61.so appends
+//                    `.%p` to a FILE without one.
+//    M61_TRACE_SIZE=N  Keep the last N bytes of records (default 64 MiB).
+//    M61_MMAP_THRESHOLD=N  Give allocations of at least N bytes their own
+//                    mappings (default 256 KiB).
+//    M61_SCAVENGE_MS=N  Release free pages that have been idle for N
+//                    milliseconds to the OS.
+//    M61_QUARANTINE=N  Hold up to N bytes of freed blocks in quarantine to
+//                    detect writes after free.
+//    M61_REDZONE=N   Follow each block with an N-byte redzone (default 16;
+//                    0 disables).
+//    M61_REDZONE_LEAD=N  Precede each block with a redzone of N bytes,
+//                    rounded up to a multiple of 16 (default 0).
+//    M61_EXPORT=1    Publish statistics for `m61top` (see m61export.hh).
+//    M61_EXPORT_MS=N  Publish every N milliseconds (default 1000).
+//    M61_SCAN_THREADS=N  Use up to N threads to mark the heap in
+//                    `m61_find_unreachable` (default: # CPUs, at most 8).
+
+static size_t sample_period;        // 0 means track every allocation
+static unsigned scan_threads = 1;
+static size_t mmap_threshold = size_t(256) << 10;
+static size_t redzone_lead;         // leading redzone bytes
+static size_t redzone_trail = 16;   // trailing redzone bytes
+static constexpr size_t max_redzone = size_t(1) << 20;
+
+static void trace_open(const char* path, size_t size);
+static void quarantine_open(size_t size);
+static void export_open(uint64_t interval);
+static void bytes_init();
+static void fork_prepare();
+static void fork_parent();
+static void fork_child();
+
+static void config_init() {
+    static bool initialized;
+    if (!initialized) {
+        bytes_init();
+        if (const char* str = getenv("M61_SAMPLE")) {
+            sample_period = strtoull(str, nullptr, 0);
+        }
+        if (const char* path = getenv("M61_TRACE")) {
+            const char* str = getenv("M61_TRACE_SIZE");
+            trace_open(path, str ? strtoull(str, nullptr, 0) : size_t(64) << 20);
+        }
+        if (const char* str = getenv("M61_MMAP_THRESHOLD")) {
+            mmap_threshold = strtoull(str, nullptr, 0);
+            if (mmap_threshold <= max_small_size) {
+                mmap_threshold = max_small_size + 1;
+            }
+        }
+        if (const char* str = getenv("M61_QUARANTINE")) {
+            quarantine_open(strtoull(str, nullptr, 0));
+        }
+        if (const char* str = getenv("M61_REDZONE")) {
+            redzone_trail = std::min(size_t(strtoull(str, nullptr, 0)), max_redzone);
+        }
+        if (const char* str = getenv("M61_REDZONE_LEAD")) {
+            redzone_lead = std::min(size_t(strtoull(str, nullptr, 0)), max_redzone);
+            redzone_lead = (redzone_lead + 15) & ~size_t(15);
+        }
+        if (const char* str = getenv("M61_SCAVENGE_MS")) {
+            scavenge_age = strtoull(str, nullptr, 0) * 1000000;
+        }
+        const char* export_str = getenv("M61_EXPORT");
+        if (export_str && strcmp(export_str, "0") != 0) {
+            const char* str = getenv("M61_EXPORT_MS");
+            uint64_t ms = str ? strtoull(str, nullptr, 0) : 1000;
+            export_open(std::max(ms, uint64_t(1)) * 1000000);
+        }
+        if (const char* str = getenv("M61_SCAN_THREADS")) {
+            scan_threads = std::max(strtoul(str, nullptr, 0), 1UL);
+        } else {
+            scan_threads = std::min(std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L), 8L);
+        }
+        pthread_atfork(fork_prepare, fork_parent, fork_child);
+        initialized = true;
+    }
+}
+
+
+// m61_spinlock
+//    A lock for data that is almost always used by just one thread.
+
+struct m61_spinlock {
+    std::atomic<bool> locked{false};
+
+    void lock() {
+        while (locked.exchange(true, std::memory_order_acquire)) {
+            while (locked.load(std::memory_order_relaxed)) {
+            }
+        }
+    }
+    void unlock() {
+        locked.store(false, std::memory_order_release);
+    }
+};
+
+
+// Threads
+//    Each thread has an `m61_thread` holding its cache of free objects, its
+//    shard of the allocation statistics, and its heavy-hitter summaries.
+//
+//    `self.list[c]` is a list of up to `2 * batch_objects[c]` free objects,
+//    threaded through their first words.
+//
+//    Statistics counters are written only by their own thread, using relaxed
+//    atomic stores rather than locked read-modify-write instructions, so
+//    counting never bounces cache lines between cores. `m61_get_statistics`
+//    sums the shards of all registered threads, plus `stats_retired`,
+//    which absorbs the shards of exited threads. `heap_min` and `heap_max`
+//    are global and only ever extended.
+//
+//    Heavy-hitter summaries (see m61hh.hh) are also per thread, so the
+//    spinlock that guards them is only contended while a report is being
+//    made. Their memory is fixed per thread. Exiting threads merge their
+//    summaries into `hh_retired`.
+//
+//    Block lifetimes are measured in ticks of `alloc_ticks`, a global count
+//    of allocations. Threads add their allocations to it in batches of
+//    `tick_batch`, so the clock is cheap to advance and off by at most
+//    `tick_batch` allocations per thread. It wraps, so lifetimes over 2^32
+//    allocations are miscounted.
+//
+//    A thread registers on its first m61 call. When it exits, its cache is
+//    returned to the slabs, its shard is retired, and any later frees from
+//    the thread go straight to the slabs.
+
+struct m61_stats_shard {
+    std::atomic<unsigned long long> nalloc;     // # allocations
+    std::atomic<unsigned long long> alloc_size; // # bytes allocated
+    std::atomic<unsigned long long> nfree;      // # frees
+    std::atomic<unsigned long long> free_size;  // # bytes freed
+    std::atomic<unsigned long long> nfail;      // # failed allocations
+    std::atomic<unsigned long long> fail_size;  // # bytes in failed allocations
+};
+
+struct m61_hh_shard {
+    m61_spinlock lock;
+    m61_hh_summary by_count;
+    m61_hh_summary by_size;
+};
+
+struct m61_thread {
+    void* list[nclasses];       // cached free objects
+    unsigned count[nclasses];   // # cached free objects
+    m61_stats_shard stats;
+    m61_hh_shard* hh;           // heavy-hitter summaries
+    uint32_t tick_pending;      // # allocations not yet in `alloc_ticks`
+    long long sample_countdown; // # bytes until next sample
+    uint64_t sample_rng;        // random state for sampling intervals
+    uintptr_t stack_lo;         // bounds of this thread's stack, once known
+    uintptr_t stack_hi;
+    const char* trace_file;     // most recently traced site file...
+    uint16_t trace_file_index;  // ...and its index in the trace file table
+    uint8_t trace_thread;       // thread number in traces
+    m61_thread* prev;           // links in `threads` list
+    m61_thread* next;
+    bool registered;
+    bool finished;              // thread is exiting
+};
+static thread_local m61_thread self;
+
+static std::mutex threads_lock;     // protects `threads`, `*_retired`, config
+static m61_thread* threads;
+static m61_stats_shard stats_retired;
+static m61_hh_shard* hh_retired;
+static std::atomic<uintptr_t> heap_min{UINTPTR_MAX};
+static std::atomic<uintptr_t> heap_max{0};
+static std::atomic<uint32_t> alloc_ticks;
+static constexpr uint32_t tick_batch = 64;
+
+static inline void stat_add(std::atomic<unsigned long long>& ctr,
+                            unsigned long long n) {
+    ctr.store(ctr.load(std::memory_order_relaxed) + n,
+              std::memory_order_relaxed);
+}
+
+static void thread_register();
+
+static inline uint32_t tick_now() {
+    return alloc_ticks.load(std::memory_order_relaxed) + self.tick_pending;
+}
+
+// stats_alloc_range(first, last, count, bytes)
+//    Count `count` allocations, `bytes` bytes in all, whose blocks lie
+//    within addresses [first, last].
+static inline void stats_alloc_range(uintptr_t first, uintptr_t last,
+                                     unsigned long long count,
+                                     unsigned long long bytes) {
+    self.tick_pending += count;
+    if (self.tick_pending >= tick_batch) {
+        alloc_ticks.fetch_add(self.tick_pending, std::memory_order_relaxed);
+        self.tick_pending = 0;
+    }
+    stat_add(self.stats.nalloc, count);
+    stat_add(self.stats.alloc_size, bytes);
+    uintptr_t lo = heap_min.load(std::memory_order_relaxed);
+    while (first < lo
+           && !heap_min.compare_exchange_weak(lo, first, std::memory_order_relaxed)) {
+    }
+    uintptr_t hi = heap_max.load(std::memory_order_relaxed);
+    while (last > hi
+           && !heap_max.compare_exchange_weak(hi, last, std::memory_order_relaxed)) {
+    }
+}
+
+static inline void stats_alloc(uintptr_t addr, size_t sz) {
+    stats_alloc_range(addr, addr + (sz ? sz - 1 : 0), 1, sz);
+}
+
+// stats_free(bytes, count)
+//    Count `count` frees, `bytes` bytes in all.
+static inline void stats_free(unsigned long long bytes, unsigned long long count = 1) {
+    stat_add(self.stats.nfree, count);
+    stat_add(self.stats.free_size, bytes);
+}
+
+// stats_fail(bytes, count)
+//    Count `count` failed allocations, `bytes` bytes in all.
+static inline void stats_fail(unsigned long long bytes, unsigned long long count = 1) {
+    stat_add(self.stats.nfail, count);
+    stat_add(self.stats.fail_size, bytes);
+}
+
+// log2_bucket(x, nbuckets)
+//    Return `x`'s bucket in a log2 histogram with `nbuckets` buckets:
+//    0 for 0, i for [2^(i-1), 2^i), and the last bucket for larger values.
+static inline unsigned log2_bucket(unsigned long long x, unsigned nbuckets) {
+    unsigned b = x ? 64 - __builtin_clzll(x) : 0;
+    return std::min(b, nbuckets - 1);
+}
+
+// hh_record(file, line, sz, count, bytes)
+//    Charge `count` allocations of `sz` bytes, `bytes` in all, to the site
+//    `file`:`line`. (Sampled allocations stand for several.)
+static inline void hh_record(const char* file, long line, size_t sz,
+                             unsigned long long count, unsigned long long bytes) {
+    if (m61_hh_shard* hh = self.hh) {
+        unsigned b = log2_bucket(sz, M61_HH_NBUCKETS);
+        std::lock_guard<m61_spinlock> guard(hh->lock);
+        hh->by_count.add(file, line, count, b, count);
+        hh->by_size.add(file, line, bytes, b, count);
+    }
+}
+
+// hh_lifetime(file, line, tick, count)
+//    Count `count` frees of blocks from `file`:`line` allocated at `tick`.
+static inline void hh_lifetime(const char* file, long line, uint32_t tick,
+                               unsigned long long count) {
+    m61_hh_shard* hh = self.hh;
+    if (hh && count) {
+        unsigned b = log2_bucket(uint32_t(tick_now() - tick), M61_HH_NBUCKETS);
+        std::lock_guard<m61_spinlock> guard(hh->lock);
+        hh->by_count.add_lifetime(file, line, b, count);
+        hh->by_size.add_lifetime(file, line, b, count);
+    }
+}
+
+static m61_hh_shard* hh_shard_new() {
+    void* mem = base_malloc(sizeof(m61_hh_shard));
+    return mem ? new (mem) m61_hh_shard : nullptr;
+}
+
+static void hh_shard_delete(m61_hh_shard* hh) {
+    hh->~m61_hh_shard();
+    base_free(hh);
+}
+
+static void tcache_drain(int sc, unsigned n) {
+    std::lock_guard<std::mutex> guard(central[sc].lock);
+    for (; n != 0 && self.list[sc]; --n, --self.count[sc]) {
+        void* ptr = self.list[sc];
+        self.list[sc] = *reinterpret_cast<void**>(ptr);
+        slab_free(pagemap_get(reinterpret_cast<uintptr_t>(ptr)), ptr);
+    }
+}
+
+// tcache_refill(sc)
+//    Move a batch of class-`sc` objects into this thread's cache and return
+//    one more. Returns nullptr if out of memory.
+static void* tcache_refill(int sc) {
+    std::lock_guard<std::mutex> guard(central[sc].lock);
+    void* ptr = slab_alloc(sc);
+    for (unsigned n = self.finished ? 0 : classes.batch_objects[sc];
+         ptr && n != 0;
+         --n) {
+        void* cached = slab_alloc(sc);
+        if (!cached) {
+            break;
+        }
+        *reinterpret_cast<void**>(cached) = self.list[sc];
+        self.list[sc] = cached;
+        ++self.count[sc];
+    }
+    return ptr;
+}
+
+static inline void* small_alloc(int sc) {
+    if (void* ptr = self.list[sc]) {
+        self.list[sc] = *reinterpret_cast<void**>(ptr);
+        *reinterpret_cast<void**>(ptr) = nullptr;
+        --self.count[sc];
+        return ptr;
+    }
+    return tcache_refill(sc);
+}
+
+static inline void small_free(int sc, void* ptr) {
+    *reinterpret_cast<void**>(ptr) = self.list[sc];
+    self.list[sc] = ptr;
+    if (++self.count[sc] > 2 * classes.batch_objects[sc] || self.finished) {
+        tcache_drain(sc, self.finished ? self.count[sc] : classes.batch_objects[sc]);
+    }
+}
+
+struct m61_thread_reaper {
+    ~m61_thread_reaper() {
+        self.finished = true;
+        for (int sc = 0; sc != nclasses; ++sc) {
+            tcache_drain(sc, self.count[sc]);
+        }
+        std::lock_guard<std::mutex> guard(threads_lock);
+        stat_add(stats_retired.nalloc, self.stats.nalloc);
+        stat_add(stats_retired.alloc_size, self.stats.alloc_size);
+        stat_add(stats_retired.nfree, self.stats.nfree);
+        stat_add(stats_retired.free_size, self.stats.free_size);
+        stat_add(stats_retired.nfail, self.stats.nfail);
+        stat_add(stats_retired.fail_size, self.stats.fail_size);
+        if (self.hh) {
+            if (!hh_retired) {
+                hh_retired = hh_shard_new();
+            }
+            if (hh_retired) {
+                std::lock_guard<m61_spinlock> hhguard(self.hh->lock);
+                hh_retired->by_count.merge(self.hh->by_count);
+                hh_retired->by_size.merge(self.hh->by_size);
+            }
+            hh_shard_delete(self.hh);
+            self.hh = nullptr;
+        }
+        if (self.next) {
+            self.next->prev = self.prev;
+        }
+        *(self.prev ? &self.prev->next : &threads) = self.next;
+    }
+};
+
+static long long sample_interval();
+
+static void thread_register() {
+    static thread_local m61_thread_reaper reaper;
+    (void) reaper;
+    self.hh = hh_shard_new();
+    std::lock_guard<std::mutex> guard(threads_lock);
+    config_init();
+    static unsigned nregistered;
+    self.trace_thread = nregistered++;
+    if (sample_period) {
+        self.sample_rng = ((reinterpret_cast<uintptr_t>(&self) ^ uint64_t(time(nullptr)))
+                           * 0x9E3779B97F4A7C15ULL) | 1;
+        self.sample_countdown = sample_interval();
+    }
+    self.next = threads;
+    if (threads) {
+        threads->prev = &self;
+    }
+    threads = &self;
+    self.registered = true;
+}
+
+
+// Sampling
+//    With `sample_period` N, every allocated byte is sampled with
+//    probability 1/N, so an allocation of `sz` bytes is sampled with
+//    probability p = 1 - exp(-sz/N). Each thread counts down an
+//    exponentially distributed number of bytes to its next sample, which
+//    costs one subtraction per allocation. A sample records its site, size,
+//    and a short stack, and stands for 1/p allocations; scaling by 1/p
+//    makes the reports' estimates unbiased.
+//
+//    Live samples are kept in a hash table keyed by address and protected
+//    by `samples_lock`. Only sampled blocks have a non-null `file`, so
+//    frees of other blocks never consult the table.
+
+struct m61_sample {
+    m61_sample* next;           // link in hash bucket
+    uintptr_t addr;
+    size_t size;
+    const char* file;
+    long line;
+    double weight;              // # allocations this sample stands for
+    const char* stack;          // call stack, as a stack site (m61stack.hh)
+};
+
+static std::mutex samples_lock;
+static m61_sample** sample_buckets;
+static size_t sample_nbuckets;
+static size_t nsamples;
+
+static inline size_t sample_bucket(uintptr_t addr, size_t nbuckets) {
+    return (((addr >> 4) * 0x9E3779B97F4A7C15ULL) >> 32) & (nbuckets - 1);
+}
+
+// sample_interval()
+//    Return a random number of bytes until the next sample, drawn from an
+//    exponential distribution with mean `sample_period`.
+static long long sample_interval() {
+    uint64_t x = self.sample_rng;       // xorshift64*
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    self.sample_rng = x;
+    double u = double((x * 0x2545F4914F6CDD1DULL) >> 11) * 0x1.0p-53;
+    return (long long) (-std::log(1.0 - u) * double(sample_period));
+}
+
+static inline bool sample_due(size_t sz) {
+    self.sample_countdown -= (long long) sz;
+    if (self.sample_countdown >= 0) {
+        return false;
+    }
+    self.sample_countdown = sample_interval();
+    return true;
+}
+
+// stack_bounds_init()
+//    Find this thread's stack bounds, `self.stack_lo` and `self.stack_hi`,
+//    if not yet known. If they cannot be found, both are set to 1.
+static void stack_bounds_init() {
+    if (!self.stack_hi) {
+        pthread_attr_t attr;
+        void* base;
+        size_t size;
+        self.stack_lo = self.stack_hi = 1;
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            if (pthread_attr_getstack(&attr, &base, &size) == 0) {
+                self.stack_lo = reinterpret_cast<uintptr_t>(base);
+                self.stack_hi = self.stack_lo + size;
+            }
+            pthread_attr_destroy(&attr);
+        }
+    }
+}
+
+// stack_walk(pcs, ra, fp)
+//    Store up to `m61_stack_depth` return addresses in `pcs`, starting with
+//    `ra` and continuing up the frame-pointer chain from `fp`, the frame of
+//    the m61 function the program called, and return how many. The walk
+//    never leaves this thread's stack, so a caller compiled without frame
+//    pointers can cut the stack short, but cannot make the walk fault.
+static int stack_walk(void** pcs, void* ra, void* fp) {
+    stack_bounds_init();
+    int n = 0;
+    pcs[n++] = ra;
+    uintptr_t frame = reinterpret_cast<uintptr_t>(fp);
+    while (n != m61_stack_depth
+           && frame >= self.stack_lo
+           && frame + 2 * sizeof(uintptr_t) <= self.stack_hi) {
+        uintptr_t next = reinterpret_cast<uintptr_t*>(frame)[0];
+        if (next <= frame
+            || next % sizeof(uintptr_t) != 0
+            || next + 2 * sizeof(uintptr_t) > self.stack_hi) {
+            break;
+        }
+        frame = next;
+        void* pc = reinterpret_cast<void**>(frame)[1];
+        if (!pc) {
+            break;
+        }
+        pcs[n++] = pc;
+    }
+    return n;
+}
+
+// sample_record(addr, sz, file, line, ra, fp)
+//    Record a sample for the new block at `addr`.
+static void sample_record(uintptr_t addr, size_t sz, const char* file, long line,
+                          void* ra, void* fp) {
+    double p = -std::expm1(-double(sz) / double(sample_period));
+    double weight = p > 0 ? 1 / p : 1;
+    hh_record(file, line, sz, std::llround(weight), std::llround(weight * double(sz)));
+
+    auto smp = reinterpret_cast<m61_sample*>(base_malloc(sizeof(m61_sample)));
+    if (!smp) {
+        return;
+    }
+    smp->addr = addr;
+    smp->size = sz;
+    smp->file = file;
+    smp->line = line;
+    smp->weight = weight;
+    void* pcs[m61_stack_depth];
+    smp->stack = m61_stack_intern(pcs, stack_walk(pcs, ra, fp));
+
+    std::lock_guard<std::mutex> guard(samples_lock);
+    if (nsamples >= sample_nbuckets) {
+        size_t nb = sample_nbuckets ? 2 * sample_nbuckets : 1024;
+        auto buckets = reinterpret_cast<m61_sample**>(
+            base_malloc(nb * sizeof(m61_sample*))
+        );
+        if (buckets) {
+            memset(buckets, 0, nb * sizeof(m61_sample*));
+            for (size_t b = 0; b != sample_nbuckets; ++b) {
+                while (m61_sample* t = sample_buckets[b]) {
+                    sample_buckets[b] = t->next;
+                    size_t nbk = sample_bucket(t->addr, nb);
+                    t->next = buckets[nbk];
+                    buckets[nbk] = t;
+                }
+            }
+            base_free(sample_buckets);
+            sample_buckets = buckets;
+            sample_nbuckets = nb;
+        } else if (!sample_nbuckets) {
+            base_free(smp);
+            return;
+        }
+    }
+    size_t b = sample_bucket(addr, sample_nbuckets);
+    smp->next = sample_buckets[b];
+    sample_buckets[b] = smp;
+    ++nsamples;
+}
+
+// sample_forget(addr)
+//    Remove the sample for the block at `addr`, if any, and return the
+//    number of allocations it stood for.
+static unsigned long long sample_forget(uintptr_t addr) {
+    m61_sample* smp = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(samples_lock);
+        if (!sample_nbuckets) {
+            return 0;
+        }
+        m61_sample** pp = &sample_buckets[sample_bucket(addr, sample_nbuckets)];
+        while (*pp && (*pp)->addr != addr) {
+            pp = &(*pp)->next;
+        }
+        if ((smp = *pp)) {
+            *pp = smp->next;
+            --nsamples;
+        }
+    }
+    unsigned long long count = smp ? std::llround(smp->weight) : 0;
+    base_free(smp);
+    return count;
+}
+
+
+// Tracing
+//    With `M61_TRACE`, every successful allocation and free appends a
+//    record to the ring in the trace file (see m61trace.hh). The file is
+//    mapped shared, so records reach it even if the program crashes.
+//    Writers claim record slots with one atomic add. Site file names are
+//    copied into the file's name table the first time they are seen;
+//    `trace_sites`, a hash table protected by `trace_sites_lock`, maps name
+//    pointers to table indexes.
+
+static m61_trace_header* trace;     // mapped trace file, or nullptr
+static m61_trace_record* trace_ring;
+static std::chrono::steady_clock::time_point trace_start;
+
+struct m61_trace_site {
+    const char* file;
+    uint16_t index;
+};
+static constexpr unsigned trace_nsites = 2 * m61_trace_max_files;
+static m61_trace_site trace_sites[trace_nsites];
+static unsigned trace_nsites_used;
+static m61_spinlock trace_sites_lock;
+
+// Defined to return true by libm61.so, whose programs often start other
+// preloaded programs with the same environment.
+__attribute__((weak)) bool m61_preloaded() {
+    return false;
+}
+
+// trace_path(buf, size, pattern)
+//    Store the trace file name for `pattern`, the value of `M61_TRACE`, in
+//    `buf`, replacing `%p` with the process ID.
+static void trace_path(char* buf, size_t size, const char* pattern) {
+    char pid[16];
+    snprintf(pid, sizeof(pid), "%d", int(getpid()));
+    size_t n = 0;
+    auto append = [&] (const char* str, size_t len) {
+        for (size_t i = 0; i != len && str[i] && n + 1 < size; ++i) {
+            buf[n++] = str[i];
+        }
+    };
+    for (const char* p = pattern; *p; ++p) {
+        if (p[0] == '%' && p[1] == 'p') {
+            append(pid, sizeof(pid));
+            ++p;
+        } else {
+            append(p, 1);
+        }
+    }
+    if (m61_preloaded() && !strstr(pattern, "%p")) {
+        append(".", 1);
+        append(pid, sizeof(pid));
+    }
+    buf[n] = '\0';
+}
+
+// trace_open(pattern, size)
+//    Start tracing into the file named by `pattern` (see `trace_path`),
+//    with a ring of about `size` bytes. The file is locked with `flock`
+//    for as long as the process lives, so a trace that another process is
+//    writing is never truncated.
+static void trace_open(const char* pattern, size_t size) {
+    char path[PATH_MAX];
+    trace_path(path, sizeof(path), pattern);
+    size_t capacity = size / sizeof(m61_trace_record);
+    capacity = capacity ? capacity : 1;
+    size_t len = m61_trace_records_offset + capacity * sizeof(m61_trace_record);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "m61: %s: %s\n", path, strerror(errno));
+        return;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        fprintf(stderr, "m61: %s: %s\n", path, errno == EWOULDBLOCK
+                ? "trace file in use by another process" : strerror(errno));
+        close(fd);
+        return;
+    }
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, len) != 0) {
+        fprintf(stderr, "m61: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return;
+    }
+    void* mem = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        fprintf(stderr, "m61: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return;
+    }
+    // keep `fd`, and so the lock, open
+    // the file starts zero-filled
+    auto hdr = reinterpret_cast<m61_trace_header*>(mem);
+    memcpy(hdr->magic, M61_TRACE_MAGIC, sizeof(hdr->magic));
+    hdr->version = M61_TRACE_VERSION;
+    hdr->capacity = capacity;
+    new (&hdr->nrecords) std::atomic<uint64_t>(0);
+    trace_ring = reinterpret_cast<m61_trace_record*>(
+        reinterpret_cast<char*>(mem) + m61_trace_records_offset
+    );
+    trace_start = std::chrono::steady_clock::now();
+    trace = hdr;
+}
+
+// trace_file_index(file)
+//    Return the trace file table index for site file `file`.
+static uint16_t trace_file_index(const char* file) {
+    if (file == self.trace_file && file) {
+        return self.trace_file_index;
+    }
+    if (!file) {
+        return m61_trace_nofile;
+    }
+    std::lock_guard<m61_spinlock> guard(trace_sites_lock);
+    unsigned i = ((reinterpret_cast<uintptr_t>(file) * 0x9E3779B97F4A7C15ULL) >> 32)
+        & (trace_nsites - 1);
+    while (trace_sites[i].file && trace_sites[i].file != file) {
+        i = (i + 1) & (trace_nsites - 1);
+    }
+    if (!trace_sites[i].file) {
+        if (trace_nsites_used == m61_trace_max_files) {
+            return m61_trace_nofile;
+        }
+        uint16_t index = m61_trace_nofile;
+        size_t len = strlen(file) + 1;
+        if (trace->names_used + len <= m61_trace_names_size) {
+            index = trace->nfiles;
+            memcpy(&trace->names[trace->names_used], file, len);
+            trace->file_offset[index] = trace->names_used;
+            trace->names_used += len;
+            ++trace->nfiles;
+        }
+        trace_sites[i] = {file, index};
+        ++trace_nsites_used;
+    }
+    self.trace_file = file;
+    self.trace_file_index = trace_sites[i].index;
+    return trace_sites[i].index;
+}
+
+static void trace_event(m61_trace_op op, uintptr_t addr, size_t sz,
+                        const char* file, long line) {
+    uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - trace_start
+    ).count();
+    uint16_t findex = trace_file_index(file);
+    uint64_t n = trace->nrecords.fetch_add(1, std::memory_order_relaxed);
+    trace_ring[n % trace->capacity] = {
+        time, addr, sz, uint32_t(line), findex, op, self.trace_thread
+    };
+}
+
+
+// Byte kernels
+//    `bytes_fill(p, n, c)` sets `p[0..n)` to `c`, and `bytes_mismatch(p,
+//    n, c)` returns the offset of the first byte of `p[0..n)` that is not
+//    `c`, or `n`. They fill and check redzones and quarantine poison. On
+//    x86-64 they use 32-byte AVX2 operations if the CPU supports them (see
+//    `bytes_init`) and 16-byte SSE2 operations otherwise; elsewhere they
+//    are plain loops.
+
+static size_t bytes_mismatch_scalar(const unsigned char* p, size_t n, unsigned char c) {
+    size_t i = 0;
+    while (i != n && p[i] == c) {
+        ++i;
+    }
+    return i;
+}
+
+static void bytes_fill_scalar(unsigned char* p, size_t n, unsigned char c) {
+    memset(p, c, n);
+}
+
+#if defined(__x86_64__)
+static size_t bytes_mismatch_sse2(const unsigned char* p, size_t n, unsigned char c) {
+    const __m128i cv = _mm_set1_epi8(char(c));
+    auto ne = [&] (size_t i) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        return unsigned(~_mm_movemask_epi8(_mm_cmpeq_epi8(v, cv)) & 0xFFFF);
+    };
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        if (ne(i) | ne(i + 16) | ne(i + 32) | ne(i + 48)) {
+            break;
+        }
+    }
+    for (; i + 16 <= n; i += 16) {
+        if (unsigned m = ne(i)) {
+            return i + __builtin_ctz(m);
+        }
+    }
+    if (i != n && n >= 16) {
+        // check the last 16 bytes, overlapping bytes already checked
+        unsigned m = ne(n - 16);
+        return m ? n - 16 + __builtin_ctz(m) : n;
+    }
+    return i + bytes_mismatch_scalar(p + i, n - i, c);
+}
+
+static void bytes_fill_sse2(unsigned char* p, size_t n, unsigned char c) {
+    if (n < 16) {
+        bytes_fill_scalar(p, n, c);
+        return;
+    }
+    const __m128i cv = _mm_set1_epi8(char(c));
+    for (size_t i = 0; i + 16 <= n; i += 16) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), cv);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p + n - 16), cv);
+}
+
+// The AVX2 kernels handle short inputs themselves, rather than calling
+// the SSE2 kernels, because mixing AVX and legacy SSE code costs far more
+// than the kernels save.
+__attribute__((target("avx2")))
+static size_t bytes_mismatch_avx2(const unsigned char* p, size_t n, unsigned char c) {
+    if (n < 32) {
+        const __m128i cv = _mm_set1_epi8(char(c));
+        if (n >= 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            if (unsigned m = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, cv)) & 0xFFFF) {
+                return __builtin_ctz(m);
+            }
+            v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + n - 16));
+            unsigned m = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, cv)) & 0xFFFF;
+            return m ? n - 16 + __builtin_ctz(m) : n;
+        }
+        return bytes_mismatch_scalar(p, n, c);
+    }
+    const __m256i cv = _mm256_set1_epi8(char(c));
+    size_t i = 0;
+    for (; i + 128 <= n; i += 128) {
+        auto v = reinterpret_cast<const __m256i*>(p + i);
+        __m256i eq = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256(v), cv),
+                             _mm256_cmpeq_epi8(_mm256_loadu_si256(v + 1), cv)),
+            _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256(v + 2), cv),
+                             _mm256_cmpeq_epi8(_mm256_loadu_si256(v + 3), cv))
+        );
+        if (_mm256_movemask_epi8(eq) != -1) {
+            break;
+        }
+    }
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        if (unsigned m = ~unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, cv)))) {
+            return i + __builtin_ctz(m);
+        }
+    }
+    if (i != n) {
+        // check the last 32 bytes, overlapping bytes already checked
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + n - 32));
+        unsigned m = ~unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, cv)));
+        return m ? n - 32 + __builtin_ctz(m) : n;
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+static void bytes_fill_avx2(unsigned char* p, size_t n, unsigned char c) {
+    if (n < 32) {
+        if (n >= 16) {
+            const __m128i cv = _mm_set1_epi8(char(c));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p), cv);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p + n - 16), cv);
+        } else {
+            bytes_fill_scalar(p, n, c);
+        }
+        return;
+    }
+    const __m256i cv = _mm256_set1_epi8(char(c));
+    for (size_t i = 0; i + 32 <= n; i += 32) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + i), cv);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + n - 32), cv);
+}
+
+static size_t (*bytes_mismatch)(const unsigned char*, size_t, unsigned char)
+    = bytes_mismatch_sse2;
+static void (*bytes_fill)(unsigned char*, size_t, unsigned char) = bytes_fill_sse2;
+
+static void bytes_init() {
+    if (__builtin_cpu_supports("avx2")) {
+        bytes_mismatch = bytes_mismatch_avx2;
+        bytes_fill = bytes_fill_avx2;
+    }
+}
+#else
+static size_t (*bytes_mismatch)(const unsigned char*, size_t, unsigned char)
+    = bytes_mismatch_scalar;
+static void (*bytes_fill)(unsigned char*, size_t, unsigned char) = bytes_fill_scalar;
+
+static void bytes_init() {
+}
+#endif
+
+// bytes_clear(ptr, n)
+//    Set `ptr[0..n)` to zero. Clears of at least `stream_clear_size` bytes
+//    use non-temporal stores, which bypass the cache: a clear that big
+//    would evict most of the cache, and its destination is unlikely to
+//    be read again soon.
+static constexpr size_t stream_clear_size = size_t(1) << 20;
+
+static void bytes_clear(void* ptr, size_t n) {
+#if defined(__x86_64__)
+    if (n >= stream_clear_size) {
+        auto p = reinterpret_cast<unsigned char*>(ptr);
+        size_t head = -reinterpret_cast<uintptr_t>(p) & 15;
+        memset(p, 0, head);
+        p += head;
+        n -= head;
+        const __m128i zero = _mm_setzero_si128();
+        for (; n >= 64; p += 64, n -= 64) {
+            auto v = reinterpret_cast<__m128i*>(p);
+            _mm_stream_si128(v, zero);
+            _mm_stream_si128(v + 1, zero);
+            _mm_stream_si128(v + 2, zero);
+            _mm_stream_si128(v + 3, zero);
+        }
+        _mm_sfence();
+        memset(p, 0, n);
+        return;
+    }
+#endif
+    memset(ptr, 0, n);
+}
+
+
+// Redzones
+//    A block of `sz` bytes occupies `redzone_lead + sz + redzone_trail`
+//    bytes: the block is preceded and followed by redzones filled with
+//    `redzone_byte`. `m61_free` checks that the redzones are intact, which
+//    catches most writes off either end of the block. Pointers returned to
+//    the user are `redzone_lead` bytes into their slab slot or span, plus
+//    the block's `pad`, which is nonzero only for aligned blocks whose
+//    alignment `redzone_lead` is not a multiple of.
+
+static constexpr unsigned char redzone_byte = 0xFD;
+
+static inline void redzone_fill(uintptr_t addr, size_t sz) {
+    auto p = reinterpret_cast<unsigned char*>(addr);
+    if (redzone_lead) {
+        bytes_fill(p - redzone_lead, redzone_lead, redzone_byte);
+    }
+    if (redzone_trail) {
+        bytes_fill(p + sz, redzone_trail, redzone_byte);
+    }
+}
+
+// redzone_check(addr, sz, file, line)
+//    Check the redzones of the `sz`-byte block at `addr`, which is being
+//    freed at `file`:`line`, and report any damage.
+static inline void redzone_check(uintptr_t addr, size_t sz, const char* file, long line) {
+    auto p = reinterpret_cast<const unsigned char*>(addr);
+    if ((redzone_lead
+         && bytes_mismatch(p - redzone_lead, redzone_lead, redzone_byte) != redzone_lead)
+        || (redzone_trail
+            && bytes_mismatch(p + sz, redzone_trail, redzone_byte) != redzone_trail)) {
+        fprintf(stderr, "MEMORY BUG: %s:%ld: detected wild write during free of pointer %p\n",
+                file, line, p);
+    }
+}
+
+
+// allocate(sz, file, line, ra, fp, align, zeroed)
+//    Allocate a block for m61_malloc, m61_calloc, and friends. `ra` and
+//    `fp` are the caller's return address and frame, for sampled stacks.
+//    The block is aligned to `align`, a power of two; if the leading
+//    redzone is not a multiple of `align`, the block's `pad` rounds its
+//    lead up to one. If `zeroed` is nonnull, `*zeroed` is set to true if
+//    the block is known to be zero.
+
+static void* allocate(size_t sz, const char* file, long line, void* ra, void* fp,
+                      size_t align = 16, bool* zeroed = nullptr) {
+    if (!self.registered) {
+        thread_register();
+    }
+    bool sampled = sample_period && sample_due(sz);
+    const char* track_file = !sample_period || sampled ? file : nullptr;
+    void* ptr = nullptr;
+    uint32_t tick = tick_now();
+    uint32_t pad = align > 16 ? uint32_t(-redzone_lead & (align - 1)) : 0;
+    size_t need = sz <= max_alloc_size ? redzone_lead + pad + sz + redzone_trail : sz;
+    int sc = -1;
+    if (need <= max_small_size) {
+        sc = align <= 16 ? size_class(need) : aligned_size_class(need, align);
+    }
+    if (sc >= 0) {
+        if ((ptr = small_alloc(sc))) {
+            uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+            m61_span* s = pagemap_get(addr);
+            unsigned i = s->index(addr);
+            s->info[i] = {track_file, uint32_t(line), uint32_t(sz), tick, pad};
+            s->allocated[i / 64].fetch_or(uint64_t(1) << (i % 64),
+                                          std::memory_order_relaxed);
+        }
+    } else if (need >= mmap_threshold && need <= max_alloc_size) {
+        ptr = mapped_alloc(need, sz, track_file, line, tick, align, pad);
+        if (zeroed) {
+            *zeroed = true;
+        }
+    } else if (need <= max_alloc_size) {
+        size_t npages = (need + page_size - 1) >> page_shift;
+        std::lock_guard<std::mutex> guard(pageheap_lock);
+        if (m61_span* s = align > page_size ? pageheap_alloc_aligned(npages, align)
+                                            : pageheap_alloc(npages)) {
+            s->state = span_large;
+            s->size = sz;
+            s->pad = pad;
+            s->file = track_file;
+            s->line = line;
+            s->tick = tick;
+            ptr = reinterpret_cast<void*>(s->first);
+            if (zeroed) {
+                *zeroed = s->zeroed;
+            }
+        }
+    }
+    if (ptr) {
+        ptr = reinterpret_cast<char*>(ptr) + redzone_lead + pad;
+        redzone_fill(reinterpret_cast<uintptr_t>(ptr), sz);
+        stats_alloc(reinterpret_cast<uintptr_t>(ptr), sz);
+        if (sampled) {
+            sample_record(reinterpret_cast<uintptr_t>(ptr), sz, file, line, ra, fp);
+        } else if (!sample_period) {
+            hh_record(file, line, sz, 1, sz);
+        }
+    } else {
+        stats_fail(sz);
+    }
+    return ptr;
+}
+
 
 /// m61_malloc(sz, file, line)
 ///    Return a pointer to `sz` bytes of newly-allocated dynamic memory.
@@ -12,39 +1841,895 @@
 ///    return a unique, newly-allocated pointer value. The allocation
 ///    request was at location `file`:`line`.
 
-void* m61_malloc(size_t sz, const char* file, long line) {
-    (void) file, (void) line;   // avoid uninitialized variable warnings
-    // Your code here.
-    return base_malloc(sz);
+void* m61_malloc(size_t sz, const char* file, long line) {
+    void* ptr = allocate(sz, file, line,
+                         __builtin_return_address(0), __builtin_frame_address(0));
+    if (trace && ptr) {
+        trace_event(m61_trace_malloc, reinterpret_cast<uintptr_t>(ptr), sz, file, line);
+    }
+    return ptr;
+}
+
+
+// Freed large spans coalesce, losing their boundaries, so `large_freed`
+// remembers the addresses of the most recently freed large blocks (under
+// `pageheap_lock`) to recognize double frees of them.
+static constexpr unsigned nlarge_freed = 64;
+static uintptr_t large_freed[nlarge_freed];
+static unsigned large_freed_next;
+
+// report_invalid_free(addr, file, line)
+//    Explain why the block at `addr` cannot be freed: it is not in the
+//    heap, it is a double free, or it is not allocated, perhaps because it
+//    points inside a live block. Only out-of-band metadata is consulted --
+//    the pagemap, slab side arrays, and span descriptors -- so user writes
+//    cannot forge a block, and classification takes constant time however
+//    many blocks are live. (Arena blocks are searched from their start.)
+
+static void report_invalid_free(uintptr_t addr, const char* file, long line) {
+    void* ptr = reinterpret_cast<void*>(addr);
+    m61_span* s = pagemap_get(addr);
+    if (!s) {
+        fprintf(stderr, "MEMORY BUG: %s:%ld: invalid free of pointer %p, not in heap\n",
+                file, line, ptr);
+        return;
+    }
+    const char* why = "not allocated";
+    uintptr_t region = 0;
+    size_t region_size = 0;
+    const char* region_file = nullptr;
+    long region_line = 0;
+    // a pointer into a slab's tail, which holds no object, is not allocated
+    if (s->state == span_slab && s->is_object(s->index(addr))) {
+        unsigned i = s->index(addr);
+        const m61_blockinfo& info = s->info[i];
+        uintptr_t start = s->first + i * classes.size[s->sizeclass] + redzone_lead
+            + (block_never_allocated(info) ? 0 : info.pad);
+        if (!s->is_allocated(i)) {
+            if (addr == start && !block_never_allocated(info)) {
+                why = "double free";
+            }
+        } else if (addr - start < info.size) {
+            region = start;
+            region_size = info.size;
+            region_file = info.file;
+            region_line = info.line;
+        }
+    } else if (s->state == span_unmapping || s->state == span_quarantined) {
+        if (addr == s->first + redzone_lead + s->pad) {
+            why = "double free";
+        }
+    } else if (s->state == span_large || s->state == span_mapped) {
+        if (addr - (s->first + redzone_lead + s->pad) < s->size) {
+            region = s->first + redzone_lead + s->pad;
+            region_size = s->size;
+            region_file = s->file;
+            region_line = s->line;
+        }
+    } else if (s->state == span_free) {
+        std::lock_guard<std::mutex> guard(pageheap_lock);
+        for (uintptr_t freed : large_freed) {
+            if (freed == addr) {
+                why = "double free";
+            }
+        }
+    } else if (s->state == span_arena) {
+        for (uintptr_t p = s->first; p < s->bump && p <= addr; ) {
+            auto h = reinterpret_cast<const m61_arena_header*>(p);
+            uintptr_t start = p + sizeof(*h);
+            if (addr >= start && addr - start < h->size) {
+                region = start;
+                region_size = h->size;
+                region_file = h->file;
+                region_line = h->line;
+            }
+            p += arena_need(h->size);
+        }
+    }
+    fprintf(stderr, "MEMORY BUG: %s:%ld: invalid free of pointer %p, %s\n",
+            file, line, ptr, why);
+    if (region_size) {
+        fprintf(stderr, "  %s:%ld: %p is %zu bytes inside a %zu byte region allocated here\n",
+                region_file ? region_file : "?", region_line, ptr,
+                size_t(addr - region), region_size);
+    }
+}
+
+
+// Quarantine
+//    With `M61_QUARANTINE`, freed slab objects and large spans, including
+//    their redzones, are filled with `poison_byte` and held in
+//    `quarantine`, a FIFO ring, rather than reused at once. While
+//    quarantined, a slab object is marked free and a large span is
+//    `span_quarantined`, so freeing it again is a double free. The oldest
+//    blocks leave the ring when it holds more than `quarantine_limit`
+//    bytes or is full; each is checked for changes to its poison, which
+//    mean a write after free, and then released for reuse. The ring is
+//    protected by `quarantine_lock`.
+
+static constexpr unsigned char poison_byte = 0xDB;
+
+struct m61_quarantined {
+    void* ptr;                  // start of the poisoned bytes
+    size_t lead;                // # bytes before the user's block
+    size_t size;                // # poisoned bytes
+    const char* file;           // where it was freed
+    long line;
+};
+
+static m61_quarantined* quarantine;
+static size_t quarantine_capacity;  // # slots in `quarantine`
+static size_t quarantine_limit;     // max # bytes held
+static size_t quarantine_head;      // index of oldest entry
+static size_t quarantine_count;
+static size_t quarantine_bytes;
+static m61_spinlock quarantine_lock;
+
+static void quarantine_open(size_t size) {
+    if (size == 0) {
+        return;
+    }
+    size_t capacity = std::min(std::max(size / 64, size_t(256)), size_t(1) << 20);
+    quarantine = reinterpret_cast<m61_quarantined*>(
+        base_malloc(capacity * sizeof(m61_quarantined))
+    );
+    if (quarantine) {
+        quarantine_capacity = capacity;
+        quarantine_limit = size;
+    }
+}
+
+// quarantine_release(q)
+//    Check the poison of `q`, which has left the quarantine, and make its
+//    memory reusable.
+static void quarantine_release(const m61_quarantined& q) {
+    size_t off = bytes_mismatch(reinterpret_cast<const unsigned char*>(q.ptr),
+                                q.size, poison_byte);
+    void* user = reinterpret_cast<unsigned char*>(q.ptr) + q.lead;
+    if (off != q.size && off < q.lead) {
+        fprintf(stderr, "MEMORY BUG: %s:%ld: detected write after free of pointer %p, "
+                "%zu bytes before\n", q.file, q.line, user, q.lead - off);
+    } else if (off != q.size) {
+        fprintf(stderr, "MEMORY BUG: %s:%ld: detected write after free of pointer %p, "
+                "%zu bytes inside\n", q.file, q.line, user, off - q.lead);
+    }
+    uintptr_t addr = reinterpret_cast<uintptr_t>(q.ptr);
+    m61_span* s = pagemap_get(addr);
+    if (s->state == span_slab) {
+        small_free(s->sizeclass, q.ptr);
+    } else {
+        std::lock_guard<std::mutex> guard(pageheap_lock);
+        large_freed[large_freed_next++ % nlarge_freed] = addr + q.lead;
+        pageheap_release(s);
+    }
+}
+
+// quarantine_push(ptr, lead, size, file, line)
+//    Poison the `size`-byte freed block at `ptr`, whose user block starts
+//    `lead` bytes in, and add it to the quarantine, releasing the oldest
+//    blocks if the quarantine is over its limits.
+static void quarantine_push(void* ptr, size_t lead, size_t size,
+                            const char* file, long line) {
+    bytes_fill(reinterpret_cast<unsigned char*>(ptr), size, poison_byte);
+    m61_quarantined evicted[8];
+    unsigned nevicted = 0;
+    {
+        std::lock_guard<m61_spinlock> guard(quarantine_lock);
+        while ((quarantine_count == quarantine_capacity
+                || quarantine_bytes + size > quarantine_limit)
+               && quarantine_count != 0
+               && nevicted != 8) {
+            evicted[nevicted] = quarantine[quarantine_head];
+            quarantine_bytes -= evicted[nevicted].size;
+            quarantine_head = (quarantine_head + 1) % quarantine_capacity;
+            --quarantine_count;
+            ++nevicted;
+        }
+        if (quarantine_count != quarantine_capacity) {
+            quarantine[(quarantine_head + quarantine_count) % quarantine_capacity]
+                = {ptr, lead, size, file, line};
+            ++quarantine_count;
+            quarantine_bytes += size;
+            ptr = nullptr;
+        }
+    }
+    for (unsigned i = 0; i != nevicted; ++i) {
+        quarantine_release(evicted[i]);
+    }
+    if (ptr) {
+        // could not make room; skip the quarantine
+        quarantine_release({ptr, lead, size, file, line});
+    }
+}
+
+
+// Fork safety
+//    A child of `fork` has only the forking thread, but inherits every lock
+//    in the state the parent left it. `fork_prepare` takes all allocator
+//    locks, in an order consistent with how they nest elsewhere, so no
+//    other thread holds one at the fork; both sides then release them.
+//    Other threads' caches and shards stay on `threads` in the child; their
+//    objects are lost to it, but their statistics stay correct.
+
+static void fork_prepare() {
+    m61_stack_fork_lock();
+    threads_lock.lock();
+    for (m61_thread* t = threads; t; t = t->next) {
+        if (t->hh) {
+            t->hh->lock.lock();
+        }
+    }
+    samples_lock.lock();
+    quarantine_lock.lock();
+    trace_sites_lock.lock();
+    for (int sc = 0; sc != nclasses; ++sc) {
+        central[sc].lock.lock();
+    }
+    pageheap_lock.lock();
+}
+
+static void fork_parent() {
+    pageheap_lock.unlock();
+    for (int sc = nclasses - 1; sc >= 0; --sc) {
+        central[sc].lock.unlock();
+    }
+    trace_sites_lock.unlock();
+    quarantine_lock.unlock();
+    samples_lock.unlock();
+    for (m61_thread* t = threads; t; t = t->next) {
+        if (t->hh) {
+            t->hh->lock.unlock();
+        }
+    }
+    threads_lock.unlock();
+    m61_stack_fork_unlock();
+}
+
+static void fork_child() {
+    // the child's one thread is the one that took the locks
+    fork_parent();
+}
+
+// release(ptr, file, line)
+//    Free the block at `ptr` for m61_free and the other freeing functions.
+
+static inline void release(void* ptr, const char* file, long line) {
+    if (!ptr) {
+        return;
+    }
+    if (!self.registered) {
+        thread_register();
+    }
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    uintptr_t base = addr - redzone_lead;
+    m61_span* s = pagemap_get(base);
+    if (s && s->state == span_slab && s->is_object(s->index(base))) {
+        unsigned i = s->index(base);
+        m61_blockinfo& info = s->info[i];
+        uint64_t bit = uint64_t(1) << (i % 64);
+        uintptr_t slot = s->first + i * classes.size[s->sizeclass];
+        if (s->is_allocated(i) && base == slot + info.pad) {
+            if (!(s->allocated[i / 64].fetch_and(~bit, std::memory_order_relaxed) & bit)) {
+                // another thread freed it first
+                report_invalid_free(addr, file, line);
+                return;
+            }
+            if (trace) {
+                trace_event(m61_trace_free, addr, 0, file, line);
+            }
+            if (info.file) {
+                hh_lifetime(info.file, info.line, info.tick,
+                            sample_period ? sample_forget(addr) : 1);
+            }
+            redzone_check(addr, info.size, file, line);
+            stats_free(info.size);
+            if (quarantine) {
+                quarantine_push(reinterpret_cast<void*>(slot), addr - slot,
+                                classes.size[s->sizeclass], file, line);
+            } else {
+                small_free(s->sizeclass, reinterpret_cast<void*>(slot));
+            }
+            return;
+        }
+    } else if (s && (s->state == span_large || s->state == span_mapped)
+               && base == s->first + s->pad) {
+        if (trace) {
+            trace_event(m61_trace_free, addr, 0, file, line);
+        }
+        if (s->file) {
+            hh_lifetime(s->file, s->line, s->tick,
+                        sample_period ? sample_forget(addr) : 1);
+        }
+        redzone_check(addr, s->size, file, line);
+        stats_free(s->size);
+        if (s->state == span_mapped) {
+            mapped_free(s);
+            return;
+        }
+        if (quarantine) {
+            s->state = span_quarantined;
+            quarantine_push(reinterpret_cast<void*>(s->first), addr - s->first,
+                            redzone_lead + s->pad + s->size + redzone_trail, file, line);
+            return;
+        }
+        std::lock_guard<std::mutex> guard(pageheap_lock);
+        large_freed[large_freed_next++ % nlarge_freed] = addr;
+        pageheap_release(s);
+        return;
+    }
+    report_invalid_free(addr, file, line);
+}
+
+
+/// m61_free(ptr, file, line)
+///    Free the memory space pointed to by `ptr`, which must have been
+///    returned by a previous call to m61_malloc. If `ptr == NULL`,
+///    does nothing. The free was called at location `file`:`line`.
+
+void m61_free(void* ptr, const char* file, long line) {
+    release(ptr, file, line);
+}
+
+
+/// m61_usable_size(ptr)
+///    Return the size of the active block at `ptr`, or 0 if `ptr` is not an
+///    active block returned by m61_malloc or m61_calloc.
+
+size_t m61_usable_size(void* ptr) {
+    uintptr_t base = reinterpret_cast<uintptr_t>(ptr) - redzone_lead;
+    m61_span* s = pagemap_get(base);
+    if (s && s->state == span_slab) {
+        unsigned i = s->index(base);
+        if (s->is_object(i) && s->is_allocated(i)
+            && base == s->first + i * classes.size[s->sizeclass] + s->info[i].pad) {
+            return s->info[i].size;
+        }
+    } else if (s && (s->state == span_large || s->state == span_mapped)
+               && base == s->first + s->pad) {
+        return s->size;
+    }
+    return 0;
+}
+
+
+/// m61_contains(ptr)
+///    Return true if `ptr` points into memory managed by m61, whether or
+///    not it is an active block.
+
+bool m61_contains(const void* ptr) {
+    return pagemap_get(reinterpret_cast<uintptr_t>(ptr)) != nullptr;
+}
+
+
+/// m61_stack_site(ra, fp)
+///    Return an allocation-site name for the call stack that starts at
+///    return address `ra` and continues up the frame-pointer chain from
+///    `fp`, the frame of the function the program called. Equal stacks
+///    get equal pointers. Reports print the stack's symbolized frames.
+
+const char* m61_stack_site(void* ra, void* fp) {
+    void* pcs[m61_stack_depth];
+    return m61_stack_intern(pcs, stack_walk(pcs, ra, fp));
+}
+
+
+/// m61_site_name(file)
+///    Return a readable name for the allocation site file `file`: the
+///    symbolized frames of a stack site from m61_stack_site, or else `file`
+///    itself. Must not be called while allocations are being made by a
+///    thread that holds the dynamic linker's lock (e.g., in `dlopen`).
+
+const char* m61_site_name(const char* file) {
+    return m61_stack_symbolize(file);
+}
+
+
+/// m61_calloc(nmemb, sz, file, line)
+///    Return a pointer to newly-allocated dynamic memory big enough to
+///    hold an array of `nmemb` elements of `sz` bytes each. If `sz == 0`,
+///    then must return a unique, newly-allocated pointer value. Returned
+///    memory should be initialized to zero. The allocation request was at
+///    location `file`:`line`.
+
+void* m61_calloc(size_t nmemb, size_t sz, const char* file, long line) {
+    if (sz != 0 && nmemb > SIZE_MAX / sz) {
+        // `nmemb * sz` overflows; count a failure of the saturated size
+        if (!self.registered) {
+            thread_register();
+        }
+        stats_fail(SIZE_MAX);
+        return nullptr;
+    }
+    bool zeroed = false;
+    void* ptr = allocate(nmemb * sz, file, line,
+                         __builtin_return_address(0), __builtin_frame_address(0),
+                         16, &zeroed);
+    if (ptr) {
+        // large blocks often come from fresh or scavenged pages, which are
+        // already zero
+        if (!zeroed) {
+            bytes_clear(ptr, nmemb * sz);
+        }
+        if (trace) {
+            trace_event(m61_trace_calloc, reinterpret_cast<uintptr_t>(ptr),
+                        nmemb * sz, file, line);
+        }
+    }
+    return ptr;
+}
+
+
+// resize_in_place(s, info, need)
+//    Try to resize a block without moving its contents so that it spans
+//    `need` bytes, including redzones. `s` is the block's span and, for
+//    slab objects, `info` its metadata. Returns the block's new first
+//    address (which differs from the old one only if `mremap` moved it),
+//    or 0 if the block must move.
+static uintptr_t resize_in_place(m61_span* s, m61_blockinfo* info, size_t need) {
+    if (info) {
+        // stay put unless that would waste more than half the object
+        size_t objsize = classes.size[s->sizeclass];
+        if (need <= objsize && need > objsize / 2) {
+            return s->first + (info - s->info) * objsize;
+        }
+    } else if (s->state == span_large) {
+        if (need > max_small_size && need < mmap_threshold) {
+            size_t npages = (need + page_size - 1) >> page_shift;
+            std::lock_guard<std::mutex> guard(pageheap_lock);
+            if (npages <= s->npages) {
+                pageheap_trim(s, npages);
+                return s->first;
+            } else if (pageheap_extend(s, npages)) {
+                return s->first;
+            }
+        }
+    } else if (need >= mmap_threshold && mapped_resize(s, need)) {
+        return s->first;
+    }
+    return 0;
+}
+
+/// m61_realloc(ptr, sz, file, line)
+///    Change the size of the block at `ptr` to `sz` bytes and return its
+///    new address. The first `min(sz, old size)` bytes are preserved.
+///    Grows and shrinks in place when the block's size class or the pages
+///    after it allow, and remaps mapped blocks with `mremap`; otherwise
+///    allocates a new block, copies, and frees `ptr`. If `ptr == NULL`,
+///    acts like m61_malloc; if `sz == 0`, frees `ptr` and returns NULL. On
+///    failure, returns NULL and leaves `ptr` alone. The request was at
+///    location `file`:`line`.
+
+void* m61_realloc(void* ptr, size_t sz, const char* file, long line) {
+    void* ra = __builtin_return_address(0);
+    void* fp = __builtin_frame_address(0);
+    if (!ptr) {
+        void* nptr = allocate(sz, file, line, ra, fp);
+        if (trace && nptr) {
+            trace_event(m61_trace_malloc, reinterpret_cast<uintptr_t>(nptr), sz, file, line);
+        }
+        return nptr;
+    } else if (sz == 0) {
+        release(ptr, file, line);
+        return nullptr;
+    }
+    if (!self.registered) {
+        thread_register();
+    }
+
+    // find the block
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    uintptr_t base = addr - redzone_lead;
+    m61_span* s = pagemap_get(base);
+    m61_blockinfo* info = nullptr;
+    size_t old_sz;
+    const char* old_file;
+    long old_line;
+    uint32_t old_tick;
+    uint32_t pad;               // kept, so a block resized in place stays put
+    if (s && s->state == span_slab) {
+        unsigned i = s->index(base);
+        if (!s->is_object(i) || !s->is_allocated(i)
+            || base != s->first + i * classes.size[s->sizeclass] + s->info[i].pad) {
+            report_invalid_free(addr, file, line);
+            return nullptr;
+        }
+        info = &s->info[i];
+        old_sz = info->size;
+        old_file = info->file;
+        old_line = info->line;
+        old_tick = info->tick;
+        pad = info->pad;
+    } else if (s && (s->state == span_large || s->state == span_mapped)
+               && base == s->first + s->pad) {
+        old_sz = s->size;
+        pad = s->pad;
+        old_file = s->file;
+        old_line = s->line;
+        old_tick = s->tick;
+    } else {
+        report_invalid_free(addr, file, line);
+        return nullptr;
+    }
+
+    redzone_check(addr, old_sz, file, line);
+
+    // resize in place, unless the block is sampled: sampled blocks move,
+    // so the sample table follows them
+    size_t need = sz <= max_alloc_size ? redzone_lead + pad + sz + redzone_trail : SIZE_MAX;
+    uintptr_t nbase = 0;
+    if (need != SIZE_MAX && !(sample_period && old_file)) {
+        nbase = resize_in_place(s, info, need);
+    }
+    if (nbase) {
+        uintptr_t naddr = nbase + redzone_lead + pad;
+        const char* track_file = sample_period ? nullptr : file;
+        if (old_file) {
+            hh_lifetime(old_file, old_line, old_tick, 1);
+        }
+        uint32_t tick = tick_now();
+        if (info) {
+            *info = {track_file, uint32_t(line), uint32_t(sz), tick, pad};
+        } else {
+            s->size = sz;
+            s->file = track_file;
+            s->line = line;
+            s->tick = tick;
+        }
+        redzone_fill(naddr, sz);
+        if (trace) {
+            trace_event(m61_trace_free, addr, 0, file, line);
+            trace_event(m61_trace_malloc, naddr, sz, file, line);
+        }
+        stats_free(old_sz);
+        stats_alloc(naddr, sz);
+        if (!sample_period) {
+            hh_record(file, line, sz, 1, sz);
+        }
+        return reinterpret_cast<void*>(naddr);
+    }
+
+    // move
+    void* nptr = allocate(sz, file, line, ra, fp);
+    if (nptr) {
+        if (trace) {
+            trace_event(m61_trace_malloc, reinterpret_cast<uintptr_t>(nptr), sz, file, line);
+        }
+        memcpy(nptr, ptr, std::min(old_sz, sz));
+        redzone_fill(addr, old_sz);     // damage was reported above
+        release(ptr, file, line);
+    }
+    return nptr;
+}
+
+
+/// m61_aligned_alloc(align, sz, file, line)
+///    Return a pointer to `sz` bytes of newly-allocated dynamic memory
+///    aligned to `align`, which must be a power of two, or NULL on failure.
+///    Alignments up to a page come from size classes whose objects are
+///    naturally aligned, and larger ones from page runs trimmed to
+///    alignment, so blocks are not padded by a whole `align`. The request
+///    was at location `file`:`line`.
+
+void* m61_aligned_alloc(size_t align, size_t sz, const char* file, long line) {
+    if (align == 0 || (align & (align - 1)) != 0) {
+        return nullptr;
+    }
+    void* ptr = allocate(sz, file, line, __builtin_return_address(0),
+                         __builtin_frame_address(0), align);
+    if (trace && ptr) {
+        trace_event(m61_trace_malloc, reinterpret_cast<uintptr_t>(ptr), sz, file, line);
+    }
+    return ptr;
+}
+
+
+/// m61_posix_memalign(ptrp, align, sz, file, line)
+///    Like m61_aligned_alloc, but store the new block's address in `*ptrp`
+///    and return 0, or return EINVAL if `align` is not a power of two
+///    multiple of `sizeof(void*)` and ENOMEM if out of memory.
+
+int m61_posix_memalign(void** ptrp, size_t align, size_t sz,
+                       const char* file, long line) {
+    if (align < sizeof(void*) || (align & (align - 1)) != 0) {
+        return EINVAL;
+    }
+    void* ptr = allocate(sz, file, line, __builtin_return_address(0),
+                         __builtin_frame_address(0), align);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    if (trace) {
+        trace_event(m61_trace_malloc, reinterpret_cast<uintptr_t>(ptr), sz, file, line);
+    }
+    *ptrp = ptr;
+    return 0;
+}
+
+
+/// m61_malloc_batch(sz, n, ptrs, file, line)
+///    Allocate up to `n` blocks of `sz` bytes, store pointers to them in
+///    `ptrs[0..n)`, and return how many were allocated; fewer than `n`
+///    means out of memory. Small blocks come from this thread's cache and
+///    then straight from the slabs under one lock, and the statistics and
+///    heavy hitters are updated once for the whole batch. Larger blocks,
+///    and all blocks when sampling, are allocated one at a time. The
+///    request was at location `file`:`line`.
+
+size_t m61_malloc_batch(size_t sz, size_t n, void** ptrs, const char* file, long line) {
+    // register first: that reads the redzone configuration
+    if (!self.registered) {
+        thread_register();
+    }
+    size_t need = sz <= max_alloc_size ? redzone_lead + sz + redzone_trail : sz;
+    if (need > max_small_size || sample_period) {
+        size_t k = 0;
+        for (; k != n; ++k) {
+            ptrs[k] = allocate(sz, file, line, __builtin_return_address(0),
+                               __builtin_frame_address(0));
+            if (!ptrs[k]) {
+                break;
+            }
+            if (trace) {
+                trace_event(m61_trace_malloc, reinterpret_cast<uintptr_t>(ptrs[k]),
+                            sz, file, line);
+            }
+        }
+        return k;
+    }
+
+    int sc = size_class(need);
+    size_t k = 0;
+    for (; k != n && self.list[sc]; ++k) {
+        ptrs[k] = self.list[sc];
+        self.list[sc] = *reinterpret_cast<void**>(ptrs[k]);
+        *reinterpret_cast<void**>(ptrs[k]) = nullptr;
+        --self.count[sc];
+    }
+    if (k != n) {
+        std::lock_guard<std::mutex> guard(central[sc].lock);
+        for (; k != n && (ptrs[k] = slab_alloc(sc)); ++k) {
+        }
+    }
+
+    // Batches are mostly runs of neighboring objects, so remember the
+    // last span and set `allocated` bits a word at a time.
+    uint32_t tick = tick_now();
+    m61_span* s = nullptr;
+    std::atomic<uint64_t>* word = nullptr;
+    uint64_t bits = 0;
+    uintptr_t first = UINTPTR_MAX, last = 0;
+    for (size_t j = 0; j != k; ++j) {
+        uintptr_t base = reinterpret_cast<uintptr_t>(ptrs[j]);
+        if (!s || base - s->first >= (s->npages << page_shift)) {
+            s = pagemap_get(base);
+        }
+        unsigned i = s->index(base);
+        s->info[i] = {file, uint32_t(line), uint32_t(sz), tick, 0};
+        if (&s->allocated[i / 64] != word) {
+            if (word) {
+                word->fetch_or(bits, std::memory_order_relaxed);
+            }
+            word = &s->allocated[i / 64];
+            bits = 0;
+        }
+        bits |= uint64_t(1) << (i % 64);
+        uintptr_t addr = base + redzone_lead;
+        redzone_fill(addr, sz);
+        ptrs[j] = reinterpret_cast<void*>(addr);
+        first = std::min(first, addr);
+        last = std::max(last, addr + (sz ? sz - 1 : 0));
+        if (trace) {
+            trace_event(m61_trace_malloc, addr, sz, file, line);
+        }
+    }
+    if (word) {
+        word->fetch_or(bits, std::memory_order_relaxed);
+    }
+    if (k) {
+        stats_alloc_range(first, last, k, k * sz);
+        hh_record(file, line, sz, k, k * sz);
+    }
+    if (k != n) {
+        stats_fail((n - k) * sz, n - k);
+    }
+    return k;
 }
 
 
-/// m61_free(ptr, file, line)
-///    Free the memory space pointed to by `ptr`, which must have been
-///    returned by a previous call to m61_malloc. If `ptr == NULL`,
-///    does nothing. The free was called at location `file`:`line`.
+/// m61_free_batch(ptrs, n, file, line)
+///    Free the `n` blocks pointed to by `ptrs[0..n)`, ignoring null
+///    pointers. Each block is checked as by m61_free. Freed slab objects
+///    go to this thread's cache, which is drained at most once per size
+///    class, and the statistics are updated once. Other blocks, and all
+///    blocks when sampling or quarantining, are freed one at a time. The
+///    free was called at location `file`:`line`.
 
-void m61_free(void* ptr, const char* file, long line) {
-    (void) file, (void) line;   // avoid uninitialized variable warnings
-    // Your code here.
-    base_free(ptr);
+void m61_free_batch(void* const* ptrs, size_t n, const char* file, long line) {
+    if (!self.registered) {
+        thread_register();
+    }
+    unsigned long long nfreed = 0, freed_size = 0;
+    uint64_t touched = 0;       // bit `sc` is set if class `sc` was freed to
+    // lifetimes are charged once per run of blocks from one site and tick
+    const char* run_file = nullptr;
+    long run_line = 0;
+    uint32_t run_tick = 0;
+    unsigned long long run_count = 0;
+    for (size_t k = 0; k != n; ++k) {
+        uintptr_t addr = reinterpret_cast<uintptr_t>(ptrs[k]);
+        uintptr_t base = addr - redzone_lead;
+        m61_span* s = ptrs[k] && !quarantine && !sample_period
+            ? pagemap_get(base) : nullptr;
+        if (!s || s->state != span_slab) {
+            // null, not a slab object, or needs quarantine or sample upkeep
+            release(ptrs[k], file, line);
+            continue;
+        }
+        unsigned i = s->index(base);
+        uint64_t bit = uint64_t(1) << (i % 64);
+        uintptr_t slot = s->first + i * classes.size[s->sizeclass];
+        if (!s->is_object(i) || base != slot + s->info[i].pad
+            || !(s->allocated[i / 64].fetch_and(~bit, std::memory_order_relaxed) & bit)) {
+            report_invalid_free(addr, file, line);
+            continue;
+        }
+        const m61_blockinfo& info = s->info[i];
+        if (trace) {
+            trace_event(m61_trace_free, addr, 0, file, line);
+        }
+        if (info.file) {
+            if (info.file != run_file || info.line != run_line
+                || info.tick != run_tick) {
+                if (run_count) {
+                    hh_lifetime(run_file, run_line, run_tick, run_count);
+                }
+                run_file = info.file;
+                run_line = info.line;
+                run_tick = info.tick;
+                run_count = 0;
+            }
+            ++run_count;
+        }
+        redzone_check(addr, info.size, file, line);
+        ++nfreed;
+        freed_size += info.size;
+        int sc = s->sizeclass;
+        *reinterpret_cast<void**>(slot) = self.list[sc];
+        self.list[sc] = reinterpret_cast<void*>(slot);
+        ++self.count[sc];
+        touched |= uint64_t(1) << sc;
+    }
+    if (run_count) {
+        hh_lifetime(run_file, run_line, run_tick, run_count);
+    }
+    stats_free(freed_size, nfreed);
+    for (; touched; touched &= touched - 1) {
+        int sc = __builtin_ctzll(touched);
+        if (self.finished) {
+            tcache_drain(sc, self.count[sc]);
+        } else if (self.count[sc] > 2 * classes.batch_objects[sc]) {
+            tcache_drain(sc, self.count[sc] - classes.batch_objects[sc]);
+        }
+    }
 }
 
 
-/// m61_calloc(nmemb, sz, file, line)
-///    Return a pointer to newly-allocated dynamic memory big enough to
-///    hold an array of `nmemb` elements of `sz` bytes each. If `sz == 0`,
-///    then must return a unique, newly-allocated pointer value. Returned
-///    memory should be initialized to zero. The allocation request was at
-///    location `file`:`line`.
+// Arenas
+//    An arena hands out memory from blocks of at least `arena_block_pages`
+//    pages by bumping a pointer, and frees everything at once. Each object
+//    is preceded by an `m61_arena_header`, so heap walks can find arena
+//    objects without any other per-object metadata. Arena blocks are
+//    linked through their spans' `next` pointers, newest first. An arena
+//    must be used by one thread at a time.
 
-void* m61_calloc(size_t nmemb, size_t sz, const char* file, long line) {
-    // Your code here (to fix test019).
-    void* ptr = m61_malloc(nmemb * sz, file, line);
-    if (ptr) {
-        memset(ptr, 0, nmemb * sz);
+static constexpr size_t arena_block_pages = 16;
+
+struct m61_arena {
+    m61_span* blocks;           // newest block first
+    unsigned long long nalloc;  // # allocations since last reset
+    unsigned long long alloc_size;  // # bytes allocated since last reset
+};
+
+static m61_span* arena_grow(m61_arena* arena, size_t need) {
+    size_t npages = (need + page_size - 1) >> page_shift;
+    npages = npages > arena_block_pages ? npages : arena_block_pages;
+    std::lock_guard<std::mutex> guard(pageheap_lock);
+    m61_span* s = pageheap_alloc(npages);
+    if (s) {
+        s->state = span_arena;
+        s->bump = s->first;
+        s->next = arena->blocks;
+        arena->blocks = s;
     }
-    return ptr;
+    return s;
+}
+
+
+/// m61_arena_create()
+///    Return a new, empty arena, or nullptr if out of memory.
+
+m61_arena* m61_arena_create() {
+    void* mem = base_malloc(sizeof(m61_arena));
+    return mem ? new (mem) m61_arena{nullptr, 0, 0} : nullptr;
+}
+
+
+/// m61_arena_alloc(arena, sz, file, line)
+///    Return a pointer to `sz` bytes of uninitialized memory from `arena`,
+///    aligned to 16 bytes. The memory stays allocated until the arena is
+///    reset or destroyed; it must not be passed to `m61_free`. Requests
+///    of 4 GiB or more fail. The request was at location `file`:`line`.
+
+void* m61_arena_alloc(m61_arena* arena, size_t sz, const char* file, long line) {
+    if (!self.registered) {
+        thread_register();
+    }
+    m61_span* s = arena->blocks;
+    size_t need = arena_need(sz);
+    if (sz > UINT32_MAX
+        || ((!s || s->last() - s->bump < need) && !(s = arena_grow(arena, need)))) {
+        stats_fail(sz);
+        return nullptr;
+    }
+    auto h = reinterpret_cast<m61_arena_header*>(s->bump);
+    h->file = file;
+    h->line = line;
+    h->size = sz;
+    s->bump += need;
+    ++arena->nalloc;
+    arena->alloc_size += sz;
+    uintptr_t addr = reinterpret_cast<uintptr_t>(h + 1);
+    stats_alloc(addr, sz);
+    if (!sample_period) {
+        hh_record(file, line, sz, 1, sz);
+    }
+    return h + 1;
+}
+
+
+/// m61_arena_reset(arena)
+///    Free every allocation in `arena` at once. The arena keeps its newest
+///    block for reuse.
+
+void m61_arena_reset(m61_arena* arena) {
+    if (!self.registered) {
+        thread_register();
+    }
+    stat_add(self.stats.nfree, arena->nalloc);
+    stat_add(self.stats.free_size, arena->alloc_size);
+    arena->nalloc = arena->alloc_size = 0;
+    m61_span* keep = arena->blocks;
+    if (!keep) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(pageheap_lock);
+    keep->bump = keep->first;
+    m61_span* s = keep->next;
+    keep->next = nullptr;
+    while (s) {
+        m61_span* next = s->next;
+        s->next = nullptr;
+        pageheap_release(s);
+        s = next;
+    }
+}
+
+
+/// m61_arena_destroy(arena)
+///    Free every allocation in `arena`, and the arena itself.
+
+void m61_arena_destroy(m61_arena* arena) {
+    if (!arena) {
+        return;
+    }
+    m61_arena_reset(arena);
+    if (m61_span* s = arena->blocks) {
+        s->next = nullptr;
+        std::lock_guard<std::mutex> guard(pageheap_lock);
+        pageheap_release(s);
+    }
+    arena->~m61_arena();
+    base_free(arena);
 }
 
 
@@ -52,9 +2737,33 @@ void* m61_calloc(size_t nmemb, size_t sz, const char* file, long line) {
 ///    Store the current memory statistics in `*stats`.
 
 void m61_get_statistics(m61_statistics* stats) {
-    // Stub: set all statistics to enormous numbers
-    memset(stats, 255, sizeof(m61_statistics));
-    // Your code here.
+    unsigned long long nalloc, alloc_size, nfree, free_size;
+    {
+        std::lock_guard<std::mutex> guard(threads_lock);
+        nalloc = stats_retired.nalloc;
+        alloc_size = stats_retired.alloc_size;
+        nfree = stats_retired.nfree;
+        free_size = stats_retired.free_size;
+        stats->nfail = stats_retired.nfail;
+        stats->fail_size = stats_retired.fail_size;
+        for (m61_thread* t = threads; t; t = t->next) {
+            nalloc += t->stats.nalloc.load(std::memory_order_relaxed);
+            alloc_size += t->stats.alloc_size.load(std::memory_order_relaxed);
+            nfree += t->stats.nfree.load(std::memory_order_relaxed);
+            free_size += t->stats.free_size.load(std::memory_order_relaxed);
+            stats->nfail += t->stats.nfail.load(std::memory_order_relaxed);
+            stats->fail_size += t->stats.fail_size.load(std::memory_order_relaxed);
+        }
+    }
+    stats->nactive = nalloc - nfree;
+    stats->active_size = alloc_size - free_size;
+    stats->ntotal = nalloc;
+    stats->total_size = alloc_size;
+    stats->heap_min = nalloc ? heap_min.load(std::memory_order_relaxed) : 0;
+    stats->heap_max = heap_max.load(std::memory_order_relaxed);
+    stats->nmapped = mapped_count.load(std::memory_order_relaxed);
+    stats->mapped_size = mapped_bytes.load(std::memory_order_relaxed);
+    stats->scavenged_size = scavenged_bytes.load(std::memory_order_relaxed);
 }
 
 
@@ -72,18 +2781,1236 @@ void m61_print_statistics() {
 }
 
 
+// print_site(file, line)
+//    Print the allocation site `file`:`line`, or, for a stack site, its
+//    frames as symbolized by `m61_stack_symbolize_all`.
+static void print_site(const char* file, long line) {
+    if (m61_stack_is_site(file)) {
+        fputs(m61_stack_name(file), stdout);
+    } else {
+        printf("%s:%ld", file, line);
+    }
+}
+
+
+// for_each_block(f)
+//    Call `f(addr, size, file, line)` for every allocated block. Holds
+//    `pageheap_lock` for one chunk at a time, so other threads' allocations
+//    stall only briefly; blocks allocated or freed during the walk may or
+//    may not be reported. `f` must not call m61.
+template <typename F>
+static void for_each_block(F f) {
+    for (size_t ci = 0; ; ++ci) {
+        std::lock_guard<std::mutex> guard(pageheap_lock);
+        if (ci == nchunks) {
+            break;
+        }
+        uintptr_t addr = chunks[ci].first;
+        uintptr_t end = addr + (chunks[ci].npages << page_shift);
+        while (addr != end) {
+            m61_span* s = pagemap_get(addr);
+            if (s->state == span_slab) {
+                size_t objsize = classes.size[s->sizeclass];
+                for (unsigned i = 0; s->first + i * objsize < s->bump; ++i) {
+                    // slots change without `pageheap_lock`; copy first
+                    m61_blockinfo info = s->info[i];
+                    if (s->is_allocated(i)) {
+                        f(s->first + i * objsize + redzone_lead + info.pad, size_t(info.size),
+                          info.file, long(info.line));
+                    }
+                }
+            } else if (s->state == span_large) {
+                f(s->first + redzone_lead + s->pad, s->size, s->file, s->line);
+            } else if (s->state == span_arena) {
+                for (uintptr_t p = s->first; p != s->bump; ) {
+                    auto h = reinterpret_cast<const m61_arena_header*>(p);
+                    f(p + sizeof(*h), size_t(h->size), h->file, long(h->line));
+                    p += arena_need(h->size);
+                }
+            }
+            addr = s->last();
+        }
+    }
+    std::lock_guard<std::mutex> guard(pageheap_lock);
+    if (mapped_spans.next) {
+        for (m61_span* s = mapped_spans.next; s != &mapped_spans; s = s->next) {
+            f(s->first + redzone_lead + s->pad, s->size, s->file, s->line);
+        }
+    }
+}
+
+// sample_leak_report()
+//    Print estimated leaks per allocation site from the live samples, with
+//    one sampled stack for each site.
+static void sample_leak_report() {
+    m61_stack_symbolize_all();
+    std::lock_guard<std::mutex> guard(samples_lock);
+    auto v = reinterpret_cast<m61_sample**>(
+        base_malloc((nsamples ? nsamples : 1) * sizeof(m61_sample*))
+    );
+    if (!v) {
+        return;
+    }
+    size_t n = 0;
+    for (size_t b = 0; b != sample_nbuckets; ++b) {
+        for (m61_sample* smp = sample_buckets[b]; smp; smp = smp->next) {
+            v[n++] = smp;
+        }
+    }
+    std::sort(v, v + n, [] (const m61_sample* a, const m61_sample* b) {
+        int cmp = strcmp(a->file, b->file);
+        return cmp < 0 || (cmp == 0 && a->line < b->line);
+    });
+    for (size_t i = 0; i != n; ) {
+        size_t j = i;
+        double objects = 0, bytes = 0;
+        for (; j != n && v[j]->line == v[i]->line
+                 && strcmp(v[j]->file, v[i]->file) == 0; ++j) {
+            objects += v[j]->weight;
+            bytes += v[j]->weight * double(v[j]->size);
+        }
+        printf("LEAK CHECK: ");
+        print_site(v[i]->file, v[i]->line);
+        printf(": ~%.0f bytes in ~%.0f objects (%zu sampled)\n",
+               bytes, objects, j - i);
+        printf("    sampled stack: %s\n", m61_stack_name(v[i]->stack));
+        i = j;
+    }
+    base_free(v);
+}
+
+
 /// m61_print_leak_report()
 ///    Print a report of all currently-active allocated blocks of dynamic
 ///    memory.
 
 void m61_print_leak_report() {
-    // Your code here.
+    if (!self.registered) {
+        thread_register();
+    }
+    if (sample_period) {
+        sample_leak_report();
+        return;
+    }
+    m61_stack_symbolize_all();
+    for_each_block([] (uintptr_t addr, size_t size, const char* file, long line) {
+        printf("LEAK CHECK: ");
+        print_site(file, line);
+        printf(": allocated object %p with size %zu\n",
+               reinterpret_cast<void*>(addr), size);
+    });
+}
+
+
+// Reachability
+//    `m61_find_unreachable` marks every block reachable from the roots and
+//    reports the allocated blocks left unmarked. A slab object's mark is
+//    its bit in `marked`; a large or mapped span's is `reached`. Marking
+//    pops address ranges off a stack and looks up every aligned word in
+//    them, through `heap_min`, `heap_max`, and the pagemap; a word that
+//    points anywhere into an allocated, unmarked block marks the block and
+//    pushes its contents. Several threads mark at once, each with its own
+//    stack; a thread with plenty of work shares some through the
+//    `m61_scan_pool` whenever another thread is idle.
+//
+//    Arena objects are treated as roots, not reported, since arenas free
+//    them all at once. Other threads may keep running during a scan, but
+//    their stacks and registers are not roots, so blocks they reach only
+//    that way, or allocate during the scan, may be reported. While a scan
+//    runs, empty slabs are not released, so marking can use slab metadata
+//    without locks. Large and mapped spans are marked, and mapped spans
+//    read, under `pageheap_lock`.
+
+static constexpr size_t scan_piece = size_t(256) << 10;    // max bytes per range
+static constexpr size_t scan_share = 64;    // # ranges moved at a time
+static constexpr size_t scan_bytes_per_thread = size_t(1) << 20;
+
+struct m61_scan_range {
+    uintptr_t first;
+    uintptr_t last;
+    m61_span* mapped;           // containing mapped span, if any
+};
+
+struct m61_scan_stack {
+    m61_scan_range* v = nullptr;
+    size_t n = 0;
+    size_t capacity = 0;
+    bool failed = false;        // out of memory, so a range was dropped
+
+    ~m61_scan_stack() {
+        base_free(v);
+    }
+    void append(const m61_scan_range& r) {
+        if (n == capacity) {
+            size_t ncapacity = capacity ? 2 * capacity : 256;
+            auto nv = reinterpret_cast<m61_scan_range*>(
+                base_malloc(ncapacity * sizeof(m61_scan_range))
+            );
+            if (!nv) {
+                failed = true;
+                return;
+            }
+            if (n) {
+                memcpy(nv, v, n * sizeof(m61_scan_range));
+            }
+            base_free(v);
+            v = nv;
+            capacity = ncapacity;
+        }
+        v[n++] = r;
+    }
+    // Push the aligned words in [first, last), in pieces of at most
+    // `scan_piece` bytes.
+    void push(uintptr_t first, uintptr_t last, m61_span* mapped = nullptr) {
+        first = (first + sizeof(uintptr_t) - 1) & ~(sizeof(uintptr_t) - 1);
+        while (last > first && last - first >= sizeof(uintptr_t)) {
+            uintptr_t end = last - first > scan_piece ? first + scan_piece : last;
+            append({first, end, mapped});
+            first = end;
+        }
+    }
+};
+
+struct m61_scan_pool {
+    std::mutex lock;
+    std::condition_variable cv;
+    m61_scan_stack shared;      // protected by `lock`
+    unsigned nworkers = 1;      // protected by `lock`
+    std::atomic<unsigned> idle{0};  // # workers waiting; changed under `lock`
+    std::atomic<bool> failed{false};
+    uintptr_t lo;               // bounds of candidate pointers
+    uintptr_t hi;
+    size_t heap_size;           // # bytes in spans in use
+};
+
+// scan_mark(v, stack)
+//    If `v` points into an allocated block that is not yet marked, mark
+//    the block and push its contents onto `stack`.
+static void scan_mark(uintptr_t v, m61_scan_stack& stack) {
+    m61_span* s = pagemap_get(v);
+    if (!s) {
+        return;
+    }
+    span_state state = s->state;
+    if (state == span_slab) {
+        std::atomic<uint64_t>* marked = s->marked;
+        int sc = s->sizeclass;
+        unsigned i = s->index(v);
+        if (!marked || !s->is_object(i) || !s->is_allocated(i)) {
+            return;
+        }
+        uint64_t bit = uint64_t(1) << (i % 64);
+        if ((marked[i / 64].load(std::memory_order_relaxed) & bit)
+            || (marked[i / 64].fetch_or(bit, std::memory_order_relaxed) & bit)) {
+            return;
+        }
+        const m61_blockinfo& info = s->info[i];
+        uintptr_t addr = s->first + i * classes.size[sc] + redzone_lead + info.pad;
+        stack.push(addr, addr + info.size);
+    } else if ((state == span_large || state == span_mapped)
+               && !s->reached.load(std::memory_order_relaxed)) {
+        uintptr_t first, last;
+        {
+            std::lock_guard<std::mutex> guard(pageheap_lock);
+            if (pagemap_get(v) != s
+                || (s->state != span_large && s->state != span_mapped)
+                || s->reached.load(std::memory_order_relaxed)) {
+                return;
+            }
+            s->reached.store(true, std::memory_order_relaxed);
+            state = s->state;
+            first = s->first + redzone_lead + s->pad;
+            last = first + s->size;
+        }
+        stack.push(first, last, state == span_mapped ? s : nullptr);
+    }
+}
+
+// scan_words(p, n, pool, stack)
+//    Mark the blocks that the `n` words at `p` point into.
+static void scan_words(const uintptr_t* p, size_t n, const m61_scan_pool* pool,
+                       m61_scan_stack& stack) {
+    uintptr_t lo = pool->lo, width = pool->hi - pool->lo;
+    for (size_t i = 0; i != n; ++i) {
+        uintptr_t v = p[i];
+        if (v - lo <= width) {
+            scan_mark(v, stack);
+        }
+    }
+}
+
+// scan_range(r, pool, stack, buf)
+//    Mark the blocks that range `r` points into. A range of a mapped span
+//    is copied into `buf`, which holds `scan_piece` bytes, under
+//    `pageheap_lock`, and skipped if the span has been freed or moved.
+static void scan_range(const m61_scan_range& r, const m61_scan_pool* pool,
+                       m61_scan_stack& stack, uintptr_t* buf) {
+    auto p = reinterpret_cast<const uintptr_t*>(r.first);
+    size_t n = (r.last - r.first) / sizeof(uintptr_t);
+    if (r.mapped) {
+        std::lock_guard<std::mutex> guard(pageheap_lock);
+        if (pagemap_get(r.first) != r.mapped
+            || r.mapped->state != span_mapped
+            || r.last > r.mapped->last()) {
+            return;
+        }
+        memcpy(buf, p, n * sizeof(uintptr_t));
+        p = buf;
+    }
+    scan_words(p, n, pool, stack);
+}
+
+// scan_work(pool)
+//    Mark blocks until every worker in `pool` runs out of ranges.
+static void scan_work(m61_scan_pool* pool) {
+    m61_scan_stack stack;
+    uintptr_t* buf = nullptr;
+    while (true) {
+        if (stack.n == 0) {
+            std::unique_lock<std::mutex> guard(pool->lock);
+            unsigned idle = pool->idle.load(std::memory_order_relaxed) + 1;
+            pool->idle.store(idle, std::memory_order_relaxed);
+            while (pool->shared.n == 0 && idle != pool->nworkers) {
+                pool->cv.wait(guard);
+                idle = pool->idle.load(std::memory_order_relaxed);
+            }
+            if (pool->shared.n == 0) {
+                pool->cv.notify_all();
+                break;
+            }
+            pool->idle.store(idle - 1, std::memory_order_relaxed);
+            size_t k = std::min(pool->shared.n, scan_share);
+            pool->shared.n -= k;
+            for (size_t i = 0; i != k; ++i) {
+                stack.append(pool->shared.v[pool->shared.n + i]);
+            }
+        }
+        m61_scan_range r = stack.v[--stack.n];
+        if (r.mapped && !buf) {
+            buf = reinterpret_cast<uintptr_t*>(base_malloc(scan_piece));
+            if (!buf) {
+                stack.failed = true;
+                continue;
+            }
+        }
+        scan_range(r, pool, stack, buf);
+        if (stack.n > scan_share
+            && pool->idle.load(std::memory_order_relaxed) != 0) {
+            std::lock_guard<std::mutex> guard(pool->lock);
+            size_t k = stack.n / 2;
+            stack.n -= k;
+            for (size_t i = 0; i != k; ++i) {
+                pool->shared.append(stack.v[stack.n + i]);
+            }
+            pool->cv.notify_all();
+        }
+    }
+    base_free(buf);
+    if (stack.failed) {
+        pool->failed.store(true, std::memory_order_relaxed);
+    }
+}
+
+static void* scan_thread(void* arg) {
+    scan_work(reinterpret_cast<m61_scan_pool*>(arg));
+    return nullptr;
+}
+
+// scan_phdr(info, size, arg)
+//    `dl_iterate_phdr` callback: push the writable segments of a loaded
+//    object, which hold its data and bss, as roots. `heap_min` and
+//    `heap_max` point into blocks, but are not roots.
+static int scan_phdr(dl_phdr_info* info, size_t, void* arg) {
+    auto roots = reinterpret_cast<m61_scan_stack*>(arg);
+    uintptr_t excluded[2] = {
+        reinterpret_cast<uintptr_t>(&heap_min), reinterpret_cast<uintptr_t>(&heap_max)
+    };
+    if (excluded[0] > excluded[1]) {
+        std::swap(excluded[0], excluded[1]);
+    }
+    for (int i = 0; i != info->dlpi_phnum; ++i) {
+        const auto& ph = info->dlpi_phdr[i];
+        if (ph.p_type == PT_LOAD && (ph.p_flags & PF_W)) {
+            uintptr_t first = info->dlpi_addr + ph.p_vaddr;
+            uintptr_t last = first + ph.p_memsz;
+            for (uintptr_t x : excluded) {
+                if (x >= first && x < last) {
+                    roots->push(first, x);
+                    first = x + sizeof(uintptr_t);
+                }
+            }
+            roots->push(first, last);
+        }
+    }
+    return 0;
+}
+
+// scan_stack(pool)
+//    Mark the blocks that this thread's stack, from the caller's frame up,
+//    points into. The caller spills its callee-saved registers into its
+//    frame first.
+__attribute__((noinline))
+static void scan_stack(m61_scan_pool* pool) {
+    stack_bounds_init();
+    uintptr_t sp = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+    if (sp >= self.stack_lo && sp < self.stack_hi) {
+        scan_words(reinterpret_cast<const uintptr_t*>(sp),
+                   (self.stack_hi - sp) / sizeof(uintptr_t), pool, pool->shared);
+    }
+}
+
+// scan_reached(addr)
+//    Return true if the block at slot or span address `addr` is marked, or
+//    is an arena object. Requires `pageheap_lock`.
+static bool scan_reached(uintptr_t addr) {
+    m61_span* s = pagemap_get(addr);
+    if (s->state == span_slab) {
+        unsigned i = s->index(addr);
+        return s->is_object(i)
+            && ((s->marked[i / 64].load(std::memory_order_relaxed) >> (i % 64)) & 1);
+    } else if (s->state == span_large || s->state == span_mapped) {
+        return s->reached.load(std::memory_order_relaxed);
+    } else {
+        return true;
+    }
+}
+
+
+// scan_begin()
+//    Start a scan: clear all marks, and return a new pool holding the
+//    roots other than this thread's stack, or nullptr if out of memory.
+__attribute__((noinline))
+static m61_scan_pool* scan_begin() {
+    void* mem = base_malloc(sizeof(m61_scan_pool));
+    if (!mem) {
+        return nullptr;
+    }
+    auto pool = new (mem) m61_scan_pool;
+    pool->lo = heap_min.load(std::memory_order_relaxed);
+    pool->lo = pool->lo > redzone_lead ? pool->lo - redzone_lead : 0;
+    pool->hi = heap_max.load(std::memory_order_relaxed);
+    pool->heap_size = mapped_bytes.load(std::memory_order_relaxed);
+    // walk one chunk at a time, collecting arena roots
+    for (size_t ci = 0; ; ++ci) {
+        std::lock_guard<std::mutex> guard(pageheap_lock);
+        if (ci == 0) {
+            ++scans_active;
+            if (mapped_spans.next) {
+                for (m61_span* s = mapped_spans.next; s != &mapped_spans; s = s->next) {
+                    s->reached.store(false, std::memory_order_relaxed);
+                }
+            }
+        }
+        if (ci == nchunks) {
+            break;
+        }
+        uintptr_t addr = chunks[ci].first;
+        uintptr_t end = addr + (chunks[ci].npages << page_shift);
+        while (addr != end) {
+            m61_span* s = pagemap_get(addr);
+            if (s->state == span_slab) {
+                unsigned nwords = (classes.slab_objects[s->sizeclass] + 63) / 64;
+                for (unsigned w = 0; w != nwords; ++w) {
+                    s->marked[w].store(0, std::memory_order_relaxed);
+                }
+            } else if (s->state == span_large) {
+                s->reached.store(false, std::memory_order_relaxed);
+            } else if (s->state == span_arena) {
+                pool->shared.push(s->first, s->bump);
+            }
+            if (s->state != span_free) {
+                pool->heap_size += s->npages << page_shift;
+            }
+            addr = s->last();
+        }
+    }
+    dl_iterate_phdr(scan_phdr, &pool->shared);
+    return pool;
+}
+
+// scan_finish(pool)
+//    Mark from the roots in `pool`, using more threads for bigger heaps,
+//    then report unmarked blocks, end the scan, and free `pool`. Returns
+//    the number of blocks reported.
+__attribute__((noinline))
+static size_t scan_finish(m61_scan_pool* pool) {
+    unsigned nthreads = std::min(
+        scan_threads, unsigned(1 + pool->heap_size / scan_bytes_per_thread)
+    );
+    pthread_t* workers = nullptr;
+    if (nthreads > 1) {
+        workers = reinterpret_cast<pthread_t*>(base_malloc(nthreads * sizeof(pthread_t)));
+    }
+    unsigned nstarted = 0;
+    if (workers) {
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        std::unique_lock<std::mutex> guard(pool->lock);
+        pool->nworkers = nthreads;
+        for (unsigned i = 1; i != nthreads; ++i) {
+            if (pthread_create(&workers[nstarted], nullptr, scan_thread, pool) == 0) {
+                ++nstarted;
+            } else {
+                --pool->nworkers;
+            }
+        }
+        guard.unlock();
+        pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    }
+    scan_work(pool);
+    for (unsigned i = 0; i != nstarted; ++i) {
+        pthread_join(workers[i], nullptr);
+    }
+    base_free(workers);
+
+    size_t n = 0;
+    if (pool->shared.failed || pool->failed.load(std::memory_order_relaxed)) {
+        fprintf(stderr, "m61_find_unreachable: out of memory\n");
+    } else {
+        m61_stack_symbolize_all();
+        for_each_block([&] (uintptr_t addr, size_t size, const char* file, long line) {
+            if (!scan_reached(addr - redzone_lead)) {
+                printf("UNREACHABLE: ");
+                print_site(file ? file : "?", line);
+                printf(": allocated object %p with size %zu\n",
+                       reinterpret_cast<void*>(addr), size);
+                ++n;
+            }
+        });
+    }
+    {
+        std::lock_guard<std::mutex> guard(pageheap_lock);
+        --scans_active;
+    }
+    pool->~m61_scan_pool();
+    base_free(pool);
+    return n;
+}
+
+
+/// m61_find_unreachable()
+///    Print a report of the allocated blocks that the program can no
+///    longer reach, and return how many there are. A block is reachable
+///    if a pointer into it is found in the program's data and bss
+///    segments, on the calling thread's stack or in its registers, or in
+///    a reachable block. Other threads' stacks and memory from other
+///    allocators are not searched.
+
+size_t m61_find_unreachable() {
+    // spill callee-saved registers into this frame for `scan_stack`; the
+    // scan's own state lives below it or in base memory, so it is not
+    // mistaken for roots
+    __builtin_unwind_init();
+    if (!self.registered) {
+        thread_register();
+    }
+    m61_scan_pool* pool = scan_begin();
+    if (!pool) {
+        fprintf(stderr, "m61_find_unreachable: out of memory\n");
+        return 0;
+    }
+    scan_stack(pool);
+    return scan_finish(pool);
+}
+
+
+// Heap maps
+//    `m61_get_heap_stats` and `m61_print_heap_map` walk the chunks like
+//    `for_each_block`, holding `pageheap_lock` for one chunk, or one line
+//    of the map, at a time.
+
+// slab_usage(s, nactive, active_size)
+//    Add the number of active objects in slab `s`, and the bytes they
+//    requested, to `*nactive` and `*active_size`.
+static void slab_usage(const m61_span* s, unsigned long long* nactive,
+                       unsigned long long* active_size) {
+    size_t objsize = classes.size[s->sizeclass];
+    for (unsigned i = 0; s->first + i * objsize < s->bump; ++i) {
+        if (s->is_allocated(i)) {
+            ++*nactive;
+            *active_size += s->info[i].size;
+        }
+    }
+}
+
+// heap_map_char(s)
+//    Return the heap map character for the pages of span `s`.
+static char heap_map_char(const m61_span* s) {
+    if (s->state == span_free) {
+        return s->scavenged ? '_' : '.';
+    } else if (s->state == span_slab) {
+        unsigned long long nactive = 0, active_size = 0;
+        slab_usage(s, &nactive, &active_size);
+        unsigned nobjects = classes.slab_objects[s->sizeclass];
+        return nactive == nobjects ? '#' : char('0' + nactive * 10 / nobjects);
+    } else if (s->state == span_large) {
+        return 'L';
+    } else if (s->state == span_quarantined) {
+        return 'Q';
+    } else if (s->state == span_arena) {
+        return 'A';
+    } else {
+        return '?';
+    }
+}
+
+
+/// m61_get_heap_stats(stats)
+///    Store the current heap usage in `*stats`.
+
+void m61_get_heap_stats(m61_heap_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (int c = 0; c != nclasses; ++c) {
+        stats->classes[c].size = classes.size[c];
+    }
+    for (size_t ci = 0; ; ++ci) {
+        std::lock_guard<std::mutex> guard(pageheap_lock);
+        if (ci == nchunks) {
+            break;
+        }
+        uintptr_t addr = chunks[ci].first;
+        uintptr_t end = addr + (chunks[ci].npages << page_shift);
+        stats->heap_size += end - addr;
+        while (addr != end) {
+            m61_span* s = pagemap_get(addr);
+            size_t bytes = s->npages << page_shift;
+            if (s->state == span_free) {
+                stats->free_size += bytes;
+                ++stats->nfree_spans;
+                stats->largest_free = std::max(stats->largest_free,
+                                               (unsigned long long) bytes);
+                stats->released_size += s->scavenged ? bytes : 0;
+            } else if (s->state == span_slab) {
+                m61_heap_class_stats& cs = stats->classes[s->sizeclass];
+                ++cs.nslabs;
+                cs.slab_size += bytes;
+                cs.nobjects += classes.slab_objects[s->sizeclass];
+                slab_usage(s, &cs.nactive, &cs.active_size);
+            } else if (s->state == span_large || s->state == span_quarantined) {
+                stats->large_size += bytes;
+                stats->active_size += s->state == span_large ? s->size : 0;
+            } else if (s->state == span_arena) {
+                stats->arena_size += bytes;
+                for (uintptr_t p = s->first; p != s->bump; ) {
+                    auto h = reinterpret_cast<const m61_arena_header*>(p);
+                    stats->active_size += h->size;
+                    p += arena_need(h->size);
+                }
+            }
+            addr = s->last();
+        }
+    }
+    unsigned long long free_slots = 0;
+    for (auto& cs : stats->classes) {
+        stats->slab_size += cs.slab_size;
+        stats->active_size += cs.active_size;
+        free_slots += (cs.nobjects - cs.nactive) * cs.size;
+    }
+    if (stats->free_size) {
+        stats->free_span_fragmentation =
+            1 - double(stats->largest_free) / stats->free_size;
+    }
+    if (stats->heap_size) {
+        stats->external_fragmentation =
+            double(stats->free_size + free_slots) / stats->heap_size;
+    }
+}
+
+
+/// m61_print_heap_map()
+///    Print the heap usage and fragmentation, the utilization of each size
+///    class with slabs, and a map of the heap with one character per page,
+///    or per group of pages in big heaps (showing the group's first page):
+///    `.` free, `_` free and released to the OS, `0`-`9` a slab 0-90%
+///    full, `#` a full slab, `L` a large block, `Q` a quarantined large
+///    block, and `A` an arena block.
+
+void m61_print_heap_map() {
+    m61_heap_stats stats;
+    m61_get_heap_stats(&stats);
+    printf("HEAP: %llu bytes: %llu in slabs, %llu large, %llu arenas, "
+           "%llu free in %llu spans (%llu released)\n",
+           stats.heap_size, stats.slab_size, stats.large_size, stats.arena_size,
+           stats.free_size, stats.nfree_spans, stats.released_size);
+    printf("HEAP: %llu bytes active; largest free span %llu bytes; "
+           "fragmentation: free-span %.1f%%, external %.1f%%\n",
+           stats.active_size, stats.largest_free,
+           100 * stats.free_span_fragmentation, 100 * stats.external_fragmentation);
+    for (auto& cs : stats.classes) {
+        if (cs.nslabs) {
+            printf("CLASS %5zu: %llu slabs, %llu of %llu objects active, "
+                   "%.1f%% of slab bytes used\n",
+                   cs.size, cs.nslabs, cs.nactive, cs.nobjects,
+                   100.0 * cs.active_size / cs.slab_size);
+        }
+    }
+
+    static constexpr size_t map_cells = 4096, line_cells = 64;
+    size_t heap_pages = stats.heap_size >> page_shift;
+    size_t cell_pages = std::max((heap_pages + map_cells - 1) / map_cells, size_t(1));
+    printf("MAP: %zu page%s per character\n", cell_pages, cell_pages == 1 ? "" : "s");
+    for (size_t ci = 0; ; ++ci) {
+        m61_chunk chunk;
+        {
+            std::lock_guard<std::mutex> guard(pageheap_lock);
+            if (ci == nchunks) {
+                break;
+            }
+            chunk = chunks[ci];
+        }
+        for (size_t p = 0; p < chunk.npages; p += line_cells * cell_pages) {
+            char line[line_cells + 1];
+            size_t n = 0;
+            {
+                std::lock_guard<std::mutex> guard(pageheap_lock);
+                for (; n != line_cells && p + n * cell_pages < chunk.npages; ++n) {
+                    uintptr_t addr = chunk.first + ((p + n * cell_pages) << page_shift);
+                    line[n] = heap_map_char(pagemap_get(addr));
+                }
+            }
+            line[n] = '\0';
+            printf("%#" PRIxPTR "  %s\n", chunk.first + (p << page_shift), line);
+        }
+    }
+}
+
+
+// print_bucket(k, nbuckets)
+//    Print the range of values in bucket `k` of a log2 histogram with
+//    `nbuckets` buckets (see `log2_bucket`).
+static void print_bucket(int k, int nbuckets) {
+    if (k == 0) {
+        printf(" 0");
+    } else if (k == nbuckets - 1) {
+        printf(" %llu+", 1ULL << (k - 1));
+    } else if (k == 1) {
+        printf(" 1");
+    } else {
+        printf(" %llu-%llu", 1ULL << (k - 1), (1ULL << k) - 1);
+    }
+}
+
+
+// Snapshots
+//    A snapshot sums the active blocks by site. Blocks are gathered into
+//    `snapshot_table`, an open-addressed hash table keyed by `file`
+//    pointer and line, which grows with `base_malloc` so that building it
+//    never calls m61. Sites whose `file` strings are equal but stored
+//    separately are merged when the table is sorted.
+
+struct snapshot_table {
+    m61_snapshot_site* slots = nullptr;
+    size_t capacity = 0;        // a power of two, or 0
+    size_t n = 0;
+    bool failed = false;
+
+    ~snapshot_table() {
+        base_free(slots);
+    }
+    static size_t hash(const char* file, long line) {
+        return (reinterpret_cast<uintptr_t>(file) ^ (uintptr_t(line) << 40))
+            * 0x9E3779B97F4A7C15ULL >> 20;
+    }
+    bool grow();
+    void add(const char* file, long line, size_t size, unsigned long long count);
+};
+
+bool snapshot_table::grow() {
+    size_t ncapacity = capacity ? 2 * capacity : 256;
+    auto nslots = reinterpret_cast<m61_snapshot_site*>(
+        base_malloc(ncapacity * sizeof(m61_snapshot_site))
+    );
+    if (!nslots) {
+        failed = true;
+        return false;
+    }
+    memset(nslots, 0, ncapacity * sizeof(m61_snapshot_site));
+    for (size_t i = 0; i != capacity; ++i) {
+        if (slots[i].file) {
+            size_t j = hash(slots[i].file, slots[i].line);
+            while (nslots[j & (ncapacity - 1)].file) {
+                ++j;
+            }
+            nslots[j & (ncapacity - 1)] = slots[i];
+        }
+    }
+    base_free(slots);
+    slots = nslots;
+    capacity = ncapacity;
+    return true;
+}
+
+void snapshot_table::add(const char* file, long line, size_t size,
+                         unsigned long long count) {
+    if (!file || (2 * (n + 1) > capacity && !grow())) {
+        return;
+    }
+    size_t j = hash(file, line);
+    m61_snapshot_site* site;
+    while ((site = &slots[j & (capacity - 1)])->file
+           && (site->file != file || site->line != line)) {
+        ++j;
+    }
+    if (!site->file) {
+        site->file = file;
+        site->line = line;
+        ++n;
+    }
+    site->count += count;
+    site->size += count * size;
+    site->hist[log2_bucket(size, M61_SNAPSHOT_NBUCKETS)] += count;
+}
+
+static bool snapshot_site_less(const m61_snapshot_site& a, const m61_snapshot_site& b) {
+    int cmp = strcmp(a.file, b.file);
+    return cmp < 0 || (cmp == 0 && a.line < b.line);
+}
+
+
+/// m61_snapshot()
+///    Return a summary of the active blocks, by allocation site, or nullptr
+///    if out of memory. In sampled mode, the summary is estimated from the
+///    live samples. The heap is walked one chunk at a time, so allocations
+///    on other threads are not held up for long. Free the snapshot with
+///    m61_snapshot_free.
+
+m61_heap_snapshot* m61_snapshot() {
+    if (!self.registered) {
+        thread_register();
+    }
+    snapshot_table t;
+    if (sample_period) {
+        std::lock_guard<std::mutex> guard(samples_lock);
+        for (size_t b = 0; b != sample_nbuckets; ++b) {
+            for (m61_sample* smp = sample_buckets[b]; smp; smp = smp->next) {
+                t.add(smp->file, smp->line, smp->size,
+                      (unsigned long long) (smp->weight + 0.5));
+            }
+        }
+    } else {
+        for_each_block([&] (uintptr_t, size_t size, const char* file, long line) {
+            t.add(file, line, size, 1);
+        });
+    }
+
+    auto snap = reinterpret_cast<m61_heap_snapshot*>(
+        base_malloc(sizeof(m61_heap_snapshot))
+    );
+    auto sites = reinterpret_cast<m61_snapshot_site*>(
+        base_malloc((t.n ? t.n : 1) * sizeof(m61_snapshot_site))
+    );
+    if (t.failed || !snap || !sites) {
+        base_free(snap);
+        base_free(sites);
+        return nullptr;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i != t.capacity; ++i) {
+        if (t.slots[i].file) {
+            sites[n++] = t.slots[i];
+        }
+    }
+    std::sort(sites, sites + n, snapshot_site_less);
+    snap->count = snap->size = 0;
+    snap->nsites = 0;
+    for (size_t i = 0; i != n; ++i) {
+        snap->count += sites[i].count;
+        snap->size += sites[i].size;
+        m61_snapshot_site* last = snap->nsites ? &sites[snap->nsites - 1] : nullptr;
+        if (last && last->line == sites[i].line
+            && strcmp(last->file, sites[i].file) == 0) {
+            last->count += sites[i].count;
+            last->size += sites[i].size;
+            for (int b = 0; b != M61_SNAPSHOT_NBUCKETS; ++b) {
+                last->hist[b] += sites[i].hist[b];
+            }
+        } else {
+            sites[snap->nsites++] = sites[i];
+        }
+    }
+    snap->sites = sites;
+    return snap;
+}
+
+
+/// m61_snapshot_free(snap)
+///    Free a snapshot returned by m61_snapshot.
+
+void m61_snapshot_free(m61_heap_snapshot* snap) {
+    if (snap) {
+        base_free(snap->sites);
+        base_free(snap);
+    }
+}
+
+
+/// m61_snapshot_diff(a, b)
+///    Print the allocation sites whose active bytes grew between snapshot
+///    `a` and later snapshot `b`, most growth first, with the size buckets
+///    that grew. Repeated over a long run, a site that keeps growing is
+///    likely a slow leak.
+
+void m61_snapshot_diff(const m61_heap_snapshot* a, const m61_heap_snapshot* b) {
+    struct growth {
+        const m61_snapshot_site* before;   // nullptr if new in `b`
+        const m61_snapshot_site* after;
+        long long dsize;
+    };
+    auto v = reinterpret_cast<growth*>(
+        base_malloc((b->nsites ? b->nsites : 1) * sizeof(growth))
+    );
+    if (!v) {
+        return;
+    }
+    size_t n = 0;
+    const m61_snapshot_site* ap = a->sites;
+    const m61_snapshot_site* aend = a->sites + a->nsites;
+    for (size_t i = 0; i != b->nsites; ++i) {
+        const m61_snapshot_site* bp = &b->sites[i];
+        while (ap != aend && snapshot_site_less(*ap, *bp)) {
+            ++ap;
+        }
+        const m61_snapshot_site* before = nullptr;
+        if (ap != aend && !snapshot_site_less(*bp, *ap)) {
+            before = ap;
+        }
+        long long dsize = (long long) bp->size - (long long) (before ? before->size : 0);
+        if (dsize > 0) {
+            v[n++] = {before, bp, dsize};
+        }
+    }
+    std::stable_sort(v, v + n, [] (const growth& x, const growth& y) {
+        return x.dsize > y.dsize;
+    });
+
+    m61_stack_symbolize_all();
+    printf("SNAPSHOT DIFF: total %+lld bytes in %+lld objects\n",
+           (long long) b->size - (long long) a->size,
+           (long long) b->count - (long long) a->count);
+    for (size_t i = 0; i != n; ++i) {
+        const m61_snapshot_site* before = v[i].before;
+        const m61_snapshot_site* after = v[i].after;
+        printf("SNAPSHOT DIFF: ");
+        print_site(after->file, after->line);
+        printf(": %+lld bytes in %+lld objects (now %llu bytes in %llu objects)\n",
+               v[i].dsize,
+               (long long) after->count - (long long) (before ? before->count : 0),
+               after->size, after->count);
+        printf("    sizes:");
+        for (int k = 0; k != M61_SNAPSHOT_NBUCKETS; ++k) {
+            long long d = (long long) after->hist[k]
+                - (long long) (before ? before->hist[k] : 0);
+            if (d != 0) {
+                print_bucket(k, M61_SNAPSHOT_NBUCKETS);
+                printf(":%+lld", d);
+            }
+        }
+        printf("\n");
+    }
+    base_free(v);
+}
+
+
+// print_histogram(label, hist)
+//    Print the nonempty buckets of `hist`, a heavy-hitter histogram.
+static void print_histogram(const char* label, const unsigned long long* hist) {
+    bool any = false;
+    for (int k = 0; k != M61_HH_NBUCKETS; ++k) {
+        if (hist[k]) {
+            if (!any) {
+                printf("    %s:", label);
+                any = true;
+            }
+            print_bucket(k, M61_HH_NBUCKETS);
+            printf(":%llu", hist[k]);
+        }
+    }
+    if (any) {
+        printf("\n");
+    }
 }
 
 
 /// m61_print_heavy_hitter_report()
-///    Print a report of heavily-used allocation locations.
+///    Print a report of heavily-used allocation locations, with each
+///    location's allocation sizes and block lifetimes.
 
 void m61_print_heavy_hitter_report() {
-    // Your heavy-hitters code here
+    // Report sites responsible for at least 10% of bytes or allocations.
+    // The summary is too big for small thread stacks.
+    auto hs = reinterpret_cast<m61_heavy_hitter_summary*>(
+        base_malloc(sizeof(m61_heavy_hitter_summary))
+    );
+    if (!hs) {
+        return;
+    }
+    m61_stack_symbolize_all();
+    for (int by_size = 1; by_size >= 0; --by_size) {
+        m61_get_heavy_hitters(hs, by_size);
+        for (size_t i = 0; i != hs->n; ++i) {
+            const m61_heavy_hitter& hh = hs->hh[i];
+            if (hh.weight * 10 < hs->total) {
+                break;
+            }
+            printf("HEAVY HITTER: ");
+            print_site(hh.file, hh.line);
+            printf(": %llu %s (~%.1f%%)\n", hh.weight,
+                   by_size ? "bytes" : "allocations",
+                   100.0 * hh.weight / hs->total);
+            print_histogram("sizes", hh.size_hist);
+            print_histogram("lifetimes", hh.lifetime_hist);
+        }
+    }
+    base_free(hs);
+}
+
+
+// hh_collect(summary, by_size, scratch)
+//    Store the current heavy-hitter summary in `*summary`, merging in
+//    `scratch`, a freshly constructed shard.
+static void hh_collect(m61_heavy_hitter_summary* summary, bool by_size,
+                       m61_hh_shard* scratch) {
+    m61_hh_summary& merged = scratch->by_count;
+    m61_hh_summary& copy = scratch->by_size;
+    {
+        std::lock_guard<std::mutex> guard(threads_lock);
+        if (hh_retired) {
+            merged = by_size ? hh_retired->by_size : hh_retired->by_count;
+        }
+        for (m61_thread* t = threads; t; t = t->next) {
+            if (t->hh) {
+                {
+                    std::lock_guard<m61_spinlock> hhguard(t->hh->lock);
+                    copy = by_size ? t->hh->by_size : t->hh->by_count;
+                }
+                merged.merge(copy);
+            }
+        }
+    }
+    merged.get(summary);
+}
+
+
+/// m61_get_heavy_hitters(summary, by_size)
+///    Store the current heavy-hitter summary in `*summary`. Sites are
+///    weighted by bytes allocated if `by_size` is true, and by number of
+///    allocations otherwise.
+
+void m61_get_heavy_hitters(m61_heavy_hitter_summary* summary, bool by_size) {
+    // a spare shard holds the summaries, which are big for the stack
+    m61_hh_shard* scratch = hh_shard_new();
+    if (!scratch) {
+        summary->total = summary->floor = summary->n = 0;
+        return;
+    }
+    hh_collect(summary, by_size, scratch);
+    hh_shard_delete(scratch);
+}
+
+
+// print_json_string(str)
+//    Print `str` as a JSON string literal.
+static void print_json_string(const char* str) {
+    putchar('"');
+    for (; *str; ++str) {
+        unsigned char ch = *str;
+        if (ch == '"' || ch == '\\') {
+            printf("\\%c", ch);
+        } else if (ch < 0x20) {
+            printf("\\u%04x", ch);
+        } else {
+            putchar(ch);
+        }
+    }
+    putchar('"');
+}
+
+static void print_json_histogram(const unsigned long long* hist) {
+    putchar('[');
+    for (int k = 0; k != M61_HH_NBUCKETS; ++k) {
+        printf(k ? ", %llu" : "%llu", hist[k]);
+    }
+    putchar(']');
+}
+
+
+/// m61_print_heavy_hitter_json()
+///    Print both heavy-hitter summaries as a JSON object,
+///    `{"by_size": SUMMARY, "by_count": SUMMARY}`. Each SUMMARY is
+///    `{"total": N, "floor": N, "sites": [SITE...]}`, listing every
+///    tracked site, heaviest first, as `{"file": F, "line": N,
+///    "weight": N, "error": N, "sizes": HIST, "lifetimes": HIST}`. A HIST
+///    is an array of `M61_HH_NBUCKETS` log2 bucket counts, as in
+///    `m61_heavy_hitter`.
+
+void m61_print_heavy_hitter_json() {
+    auto hs = reinterpret_cast<m61_heavy_hitter_summary*>(
+        base_malloc(sizeof(m61_heavy_hitter_summary))
+    );
+    if (!hs) {
+        return;
+    }
+    m61_stack_symbolize_all();
+    printf("{");
+    for (int by_size = 1; by_size >= 0; --by_size) {
+        m61_get_heavy_hitters(hs, by_size);
+        printf("%s\"%s\": {\"total\": %llu, \"floor\": %llu, \"sites\": [",
+               by_size ? "" : ",\n ", by_size ? "by_size" : "by_count",
+               hs->total, hs->floor);
+        for (size_t i = 0; i != hs->n; ++i) {
+            const m61_heavy_hitter& hh = hs->hh[i];
+            printf(i ? ",\n  {\"file\": " : "\n  {\"file\": ");
+            print_json_string(m61_stack_name(hh.file));
+            printf(", \"line\": %ld, \"weight\": %llu, \"error\": %llu, \"sizes\": ",
+                   hh.line, hh.weight, hh.error);
+            print_json_histogram(hh.size_hist);
+            printf(", \"lifetimes\": ");
+            print_json_histogram(hh.lifetime_hist);
+            printf("}");
+        }
+        printf("]}");
+    }
+    printf("}\n");
+    base_free(hs);
+}
+
+
+// Stats export
+//    With `M61_EXPORT`, `export_thread` publishes statistics and the
+//    heaviest sites into `export_hdr` every `interval` ns (see
+//    m61export.hh). It never calls m61 and holds allocator locks only as
+//    reports do: `threads_lock` and each thread's heavy-hitter spinlock,
+//    briefly. Its buffers are allocated by `export_open`. It blocks all
+//    signals, so the program's signals still go to the program's own
+//    threads. At exit, `export_close` stops and joins it before static
+//    destructors (including the base allocator's) run.
+
+static m61_export_header* export_hdr;
+static char export_name[32];
+static pid_t export_pid;                // process that opened the export
+static pthread_t export_tid;
+static bool export_running;
+static std::mutex export_lock;
+static std::condition_variable export_cv;
+static bool export_stopping;            // protected by `export_lock`
+static m61_hh_shard* export_scratch;
+static m61_heavy_hitter_summary* export_hs;     // 2 summaries
+static m61_export_data* export_data;
+
+static void export_close() {
+    if (getpid() != export_pid) {
+        // a forked child has no exporter, and the object is its parent's
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(export_lock);
+        export_stopping = true;
+    }
+    export_cv.notify_all();
+    if (export_running) {
+        pthread_join(export_tid, nullptr);
+        export_running = false;
+    }
+    shm_unlink(export_name);
+}
+
+// export_publish(hs, data)
+//    Fill `*data` with the current statistics and heavy hitters, using
+//    `hs[0]` and `hs[1]` as scratch space.
+static void export_publish(m61_heavy_hitter_summary* hs, m61_export_data* data) {
+    m61_get_statistics(&data->stats);
+    for (int i = 0; i != 2; ++i) {
+        export_scratch->~m61_hh_shard();
+        new (export_scratch) m61_hh_shard;
+        hh_collect(&hs[i], i == 0, export_scratch);
+    }
+    data->hh_total = hs[0].total;
+    data->nsites = std::min(hs[0].n, size_t(m61_export_nsites));
+    for (unsigned i = 0; i != data->nsites; ++i) {
+        const m61_heavy_hitter& hh = hs[0].hh[i];
+        m61_export_site& site = data->sites[i];
+        if (m61_stack_is_site(hh.file)) {
+            snprintf(site.name, sizeof(site.name), "%s", m61_stack_symbolize(hh.file));
+        } else {
+            snprintf(site.name, sizeof(site.name), "%s:%ld", hh.file, hh.line);
+        }
+        site.size = hh.weight;
+        site.count = 0;
+        for (size_t j = 0; j != hs[1].n; ++j) {
+            if (hs[1].hh[j].file == hh.file && hs[1].hh[j].line == hh.line) {
+                site.count = hs[1].hh[j].weight;
+                break;
+            }
+        }
+    }
+    data->time = now_ns();
+}
+
+static void* export_thread(void*) {
+    std::chrono::nanoseconds interval(export_hdr->interval);
+    std::unique_lock<std::mutex> guard(export_lock);
+    while (!export_stopping) {
+        guard.unlock();
+        export_publish(export_hs, export_data);
+        uint64_t seq = export_hdr->seq.load(std::memory_order_relaxed);
+        export_hdr->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&export_hdr->data, export_data, sizeof(*export_data));
+        export_hdr->seq.store(seq + 2, std::memory_order_release);
+        guard.lock();
+        export_cv.wait_for(guard, interval, [] { return export_stopping; });
+    }
+    return nullptr;
+}
+
+static void export_open(uint64_t interval) {
+    export_scratch = hh_shard_new();
+    export_hs = reinterpret_cast<m61_heavy_hitter_summary*>(
+        base_malloc(2 * sizeof(m61_heavy_hitter_summary) + sizeof(m61_export_data))
+    );
+    if (!export_scratch || !export_hs) {
+        fprintf(stderr, "m61: stats export: out of memory\n");
+        return;
+    }
+    export_data = reinterpret_cast<m61_export_data*>(&export_hs[2]);
+    memset(export_data, 0, sizeof(*export_data));
+    snprintf(export_name, sizeof(export_name), "/m61.%d", int(getpid()));
+    int fd = shm_open(export_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof(m61_export_header)) != 0) {
+        fprintf(stderr, "m61: %s: %s\n", export_name, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            shm_unlink(export_name);
+        }
+        return;
+    }
+    void* mem = mmap(nullptr, sizeof(m61_export_header), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        fprintf(stderr, "m61: %s: %s\n", export_name, strerror(errno));
+        shm_unlink(export_name);
+        return;
+    }
+    // the object starts zero-filled
+    auto hdr = reinterpret_cast<m61_export_header*>(mem);
+    memcpy(hdr->magic, M61_EXPORT_MAGIC, sizeof(hdr->magic));
+    hdr->version = M61_EXPORT_VERSION;
+    hdr->pid = getpid();
+    hdr->interval = interval;
+    new (&hdr->seq) std::atomic<uint64_t>(0);
+    export_hdr = hdr;
+    export_pid = getpid();
+    atexit(export_close);
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (int r = pthread_create(&export_tid, nullptr, export_thread, nullptr)) {
+        fprintf(stderr, "m61: %s: %s\n", export_name, strerror(r));
+    } else {
+        export_running = true;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
 }
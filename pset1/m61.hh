@@ -22,6 +22,59 @@ void m61_free(void* ptr, const char* file, long line);
 ///    should be initialized to zero.
 void* m61_calloc(size_t nmemb, size_t sz, const char* file, long line);
 
+/// m61_realloc(ptr, sz, file, line)
+///    Change the size of the block at `ptr` to `sz` bytes, preserving its
+///    contents up to the lesser of the old and new sizes, and return its
+///    new address. Resizes in place when possible.
+void* m61_realloc(void* ptr, size_t sz, const char* file, long line);
+
+/// m61_aligned_alloc(align, sz, file, line)
+///    Return a pointer to `sz` bytes of newly-allocated dynamic memory
+///    aligned to `align`, a power of two.
+void* m61_aligned_alloc(size_t align, size_t sz, const char* file, long line);
+
+/// m61_posix_memalign(ptrp, align, sz, file, line)
+///    Like `posix_memalign`: store a pointer to `sz` bytes aligned to
+///    `align` in `*ptrp` and return 0, or return an error number.
+int m61_posix_memalign(void** ptrp, size_t align, size_t sz,
+                       const char* file, long line);
+
+/// m61_malloc_batch(sz, n, ptrs, file, line)
+///    Allocate up to `n` blocks of `sz` bytes, store pointers to them in
+///    `ptrs[0..n)`, and return how many were allocated. Faster than `n`
+///    calls to m61_malloc for small blocks.
+size_t m61_malloc_batch(size_t sz, size_t n, void** ptrs, const char* file, long line);
+
+/// m61_free_batch(ptrs, n, file, line)
+///    Free the `n` blocks pointed to by `ptrs[0..n)`. Null pointers are
+///    ignored.
+void m61_free_batch(void* const* ptrs, size_t n, const char* file, long line);
+
+
+/// m61_usable_size(ptr)
+///    Return the size of the active block at `ptr`, or 0 if `ptr` is not an
+///    active block returned by m61_malloc or m61_calloc.
+size_t m61_usable_size(void* ptr);
+
+/// m61_contains(ptr)
+///    Return true if `ptr` points into memory managed by m61.
+bool m61_contains(const void* ptr);
+
+
+/// m61_stack_site(ra, fp)
+///    Return an allocation-site name for the call stack starting at return
+///    address `ra` and continuing up the frame-pointer chain from frame
+///    `fp`, usually `__builtin_return_address(0)` and
+///    `__builtin_frame_address(0)`. Pass it as `file`, with `line` 0, when
+///    there is no source location. Equal stacks get equal pointers, and
+///    reports print the stack's symbolized frames.
+const char* m61_stack_site(void* ra, void* fp);
+
+/// m61_site_name(file)
+///    Return a readable name for the allocation site file `file`, which
+///    may come from m61_stack_site.
+const char* m61_site_name(const char* file);
+
 
 /// m61_statistics
 ///    Structure tracking memory statistics.
@@ -34,6 +87,9 @@ struct m61_statistics {
     unsigned long long fail_size;       // # bytes in failed alloc attempts
     uintptr_t heap_min;                 // smallest allocated addr
     uintptr_t heap_max;                 // largest allocated addr
+    unsigned long long nmapped;         // # active allocations with own mmap
+    unsigned long long mapped_size;     // # bytes mapped for those allocations
+    unsigned long long scavenged_size;  // # idle free bytes released to OS
 };
 
 /// m61_get_statistics(stats)
@@ -49,10 +105,165 @@ void m61_print_statistics();
 ///    memory.
 void m61_print_leak_report();
 
+/// m61_find_unreachable()
+///    Print a report of the allocated blocks that the program can no
+///    longer reach, found by conservatively scanning the program's data,
+///    the calling thread's stack and registers, and reachable blocks for
+///    pointers. Returns the number of blocks reported.
+size_t m61_find_unreachable();
+
 /// m61_print_heavy_hitter_report()
 ///    Print a report of heavily-used allocation locations.
 void m61_print_heavy_hitter_report();
 
+
+/// m61_heap_class_stats
+///    How the slabs of one size class are used.
+#define M61_NCLASSES 40
+struct m61_heap_class_stats {
+    size_t size;                        // object size
+    unsigned long long nslabs;          // # slabs
+    unsigned long long slab_size;       // # bytes in those slabs
+    unsigned long long nobjects;        // # objects that fit in those slabs
+    unsigned long long nactive;         // # active objects
+    unsigned long long active_size;     // # bytes requested by active objects
+};
+
+/// m61_heap_stats
+///    How the pages of m61's heap are used. The heap is the memory m61 has
+///    divided into pages; allocations with their own mappings are not
+///    included. `free_span_fragmentation` is `1 - largest_free / free_size`:
+///    0 if all free pages are in one span, near 1 if they are scattered.
+///    `external_fragmentation` is the fraction of the heap in no block:
+///    free spans plus free slab objects.
+struct m61_heap_stats {
+    unsigned long long heap_size;       // # bytes in the heap
+    unsigned long long active_size;     // # bytes requested by active blocks
+    unsigned long long slab_size;       // # bytes in slabs
+    unsigned long long large_size;      // # bytes in large blocks' spans
+    unsigned long long arena_size;      // # bytes in arena blocks
+    unsigned long long free_size;       // # bytes in free spans
+    unsigned long long nfree_spans;     // # free spans
+    unsigned long long largest_free;    // # bytes in the largest free span
+    unsigned long long released_size;   // # free bytes released to the OS
+    double free_span_fragmentation;
+    double external_fragmentation;
+    m61_heap_class_stats classes[M61_NCLASSES];
+};
+
+/// m61_get_heap_stats(stats)
+///    Store the current heap usage in `*stats`.
+void m61_get_heap_stats(m61_heap_stats* stats);
+
+/// m61_print_heap_map()
+///    Print the heap usage, per-class slab utilization, and a map of the
+///    heap's pages.
+void m61_print_heap_map();
+
+
+/// m61_snapshot_site
+///    An allocation site's active blocks in a heap snapshot. `hist[0]`
+///    counts blocks of size 0, `hist[i]` blocks with sizes in
+///    [2^(i-1), 2^i), and the last bucket all larger blocks too.
+#define M61_SNAPSHOT_NBUCKETS 32
+struct m61_snapshot_site {
+    const char* file;
+    long line;
+    unsigned long long count;           // # active blocks
+    unsigned long long size;            // # bytes in active blocks
+    unsigned long long hist[M61_SNAPSHOT_NBUCKETS];
+};
+
+/// m61_heap_snapshot
+///    A summary of the active blocks at one moment, by allocation site.
+///    `sites` is sorted by file name, then line.
+struct m61_heap_snapshot {
+    unsigned long long count;           // # active blocks
+    unsigned long long size;            // # bytes in active blocks
+    size_t nsites;
+    m61_snapshot_site* sites;
+};
+
+/// m61_snapshot()
+///    Return a snapshot of the active blocks, or nullptr if out of memory.
+m61_heap_snapshot* m61_snapshot();
+
+/// m61_snapshot_free(snap)
+///    Free a snapshot returned by m61_snapshot.
+void m61_snapshot_free(m61_heap_snapshot* snap);
+
+/// m61_snapshot_diff(a, b)
+///    Print the allocation sites whose active bytes grew between snapshot
+///    `a` and later snapshot `b`.
+void m61_snapshot_diff(const m61_heap_snapshot* a, const m61_heap_snapshot* b);
+
+
+/// m61_heavy_hitter
+///    An allocation site's entry in a heavy-hitter summary. The site's true
+///    weight (allocation count or bytes) is between `weight - error` and
+///    `weight`. `size_hist` counts the site's allocations by size and
+///    `lifetime_hist` its freed blocks by lifetime, measured in allocations
+///    made (by any site) between allocation and free. In both, bucket 0 is
+///    for 0, bucket i for values in [2^(i-1), 2^i), and the last bucket
+///    for all larger values too.
+#define M61_HH_NBUCKETS 32
+struct m61_heavy_hitter {
+    const char* file;
+    long line;
+    unsigned long long weight;
+    unsigned long long error;
+    unsigned long long size_hist[M61_HH_NBUCKETS];
+    unsigned long long lifetime_hist[M61_HH_NBUCKETS];
+};
+
+/// m61_heavy_hitter_summary
+///    The heaviest allocation sites, heaviest first. At most
+///    `M61_HH_CAPACITY` sites are tracked per thread; any site not in `hh`
+///    weighs at most `floor`, and `floor` and every `error` are at most
+///    about `total / M61_HH_CAPACITY`.
+#define M61_HH_CAPACITY 128
+struct m61_heavy_hitter_summary {
+    unsigned long long total;           // total weight of all sites
+    unsigned long long floor;           // bound on untracked sites' weight
+    size_t n;                           // # entries in `hh`
+    m61_heavy_hitter hh[M61_HH_CAPACITY];
+};
+
+/// m61_get_heavy_hitters(summary, by_size)
+///    Store the current heavy-hitter summary in `*summary`. Sites are
+///    weighted by bytes allocated if `by_size` is true, and by number of
+///    allocations otherwise.
+void m61_get_heavy_hitters(m61_heavy_hitter_summary* summary, bool by_size);
+
+/// m61_print_heavy_hitter_json()
+///    Print both heavy-hitter summaries, with every tracked site and its
+///    histograms, as a JSON object.
+void m61_print_heavy_hitter_json();
+
+/// m61_arena
+///    An arena: a group of allocations made by bumping a pointer and freed
+///    all at once. Arena allocations count in `m61_statistics` and appear
+///    in leak reports. An arena must be used by one thread at a time.
+struct m61_arena;
+
+/// m61_arena_create()
+///    Return a new, empty arena, or nullptr if out of memory.
+m61_arena* m61_arena_create();
+
+/// m61_arena_alloc(arena, sz, file, line)
+///    Return a pointer to `sz` bytes of uninitialized memory from `arena`,
+///    aligned to 16 bytes. Never pass it to `m61_free`.
+void* m61_arena_alloc(m61_arena* arena, size_t sz, const char* file, long line);
+
+/// m61_arena_reset(arena)
+///    Free every allocation in `arena` at once.
+void m61_arena_reset(m61_arena* arena);
+
+/// m61_arena_destroy(arena)
+///    Free every allocation in `arena`, and the arena itself.
+void m61_arena_destroy(m61_arena* arena);
+
+
 /// `m61.cc` should use these functions rather than malloc() and free().
 void* base_malloc(size_t sz);
 void base_free(void* ptr);
@@ -64,25 +275,54 @@ void base_allocator_disable(bool is_disabled);
 #define malloc(sz)          m61_malloc((sz), __FILE__, __LINE__)
 #define free(ptr)           m61_free((ptr), __FILE__, __LINE__)
 #define calloc(nmemb, sz)   m61_calloc((nmemb), (sz), __FILE__, __LINE__)
+#define realloc(ptr, sz)    m61_realloc((ptr), (sz), __FILE__, __LINE__)
+#define aligned_alloc(align, sz) m61_aligned_alloc((align), (sz), __FILE__, __LINE__)
+#define posix_memalign(ptrp, align, sz) \
+    m61_posix_memalign((ptrp), (align), (sz), __FILE__, __LINE__)
 #endif
 
 
 /// This magic class lets standard C++ containers use your debugging allocator,
 /// instead of the system allocator.
+///
+/// An allocator tags its allocations with the `file`:`line` where it was
+/// constructed, and containers copy their allocators. Only an explicitly
+/// constructed allocator is tagged with the program's location: a
+/// container that constructs its own, as in `std::vector<int,
+/// m61_allocator<int>> v;`, tags its memory with a line in the standard
+/// library's headers, which every such container shares. To tag a
+/// container's memory with its own location, pass it an allocator:
+/// `std::map<K, V, std::less<K>, m61_allocator<std::pair<const K, V>>>
+/// m(m61_allocator<std::pair<const K, V>>{})`.
 template <typename T>
 class m61_allocator {
 public:
     using value_type = T;
-    m61_allocator() noexcept = default;
+    m61_allocator(const char* file = __builtin_FILE(),
+                  long line = __builtin_LINE()) noexcept
+        : file_(file), line_(line) {
+    }
     m61_allocator(const m61_allocator<T>&) noexcept = default;
-    template <typename U> m61_allocator(m61_allocator<U>&) noexcept {}
+    template <typename U> m61_allocator(const m61_allocator<U>& x) noexcept
+        : file_(x.file()), line_(x.line()) {
+    }
 
     T* allocate(size_t n) {
-        return reinterpret_cast<T*>(m61_malloc(n * sizeof(T), "?", 0));
+        return reinterpret_cast<T*>(m61_malloc(n * sizeof(T), file_, line_));
     }
     void deallocate(T* ptr, size_t) {
-        m61_free(ptr, "?", 0);
+        m61_free(ptr, file_, line_);
+    }
+    const char* file() const noexcept {
+        return file_;
+    }
+    long line() const noexcept {
+        return line_;
     }
+
+private:
+    const char* file_;
+    long line_;
 };
 template <typename T, typename U>
 inline constexpr bool operator==(const m61_allocator<T>&, const m61_allocator<U>&) {
@@ -93,6 +333,52 @@ inline constexpr bool operator!=(const m61_allocator<T>&, const m61_allocator<U>
     return false;
 }
 
+/// This class lets standard C++ containers allocate from an arena. Freeing
+/// does nothing; the memory is reclaimed when the arena is reset or
+/// destroyed. Like `m61_allocator`, it tags allocations with the location
+/// where it was constructed.
+template <typename T>
+class m61_arena_allocator {
+public:
+    using value_type = T;
+    explicit m61_arena_allocator(m61_arena* arena,
+                                 const char* file = __builtin_FILE(),
+                                 long line = __builtin_LINE()) noexcept
+        : arena_(arena), file_(file), line_(line) {
+    }
+    template <typename U> m61_arena_allocator(const m61_arena_allocator<U>& x) noexcept
+        : arena_(x.arena()), file_(x.file()), line_(x.line()) {
+    }
+
+    T* allocate(size_t n) {
+        return reinterpret_cast<T*>(m61_arena_alloc(arena_, n * sizeof(T), file_, line_));
+    }
+    void deallocate(T*, size_t) {
+    }
+    m61_arena* arena() const noexcept {
+        return arena_;
+    }
+    const char* file() const noexcept {
+        return file_;
+    }
+    long line() const noexcept {
+        return line_;
+    }
+
+private:
+    m61_arena* arena_;
+    const char* file_;
+    long line_;
+};
+template <typename T, typename U>
+inline bool operator==(const m61_arena_allocator<T>& a, const m61_arena_allocator<U>& b) {
+    return a.arena() == b.arena();
+}
+template <typename T, typename U>
+inline bool operator!=(const m61_arena_allocator<T>& a, const m61_arena_allocator<U>& b) {
+    return a.arena() != b.arena();
+}
+
 /// Returns a random integer between `min` and `max`, using randomness from
 /// `randomness`.
 template <typename Engine, typename T>
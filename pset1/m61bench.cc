@@ -0,0 +1,606 @@
+#define M61_DISABLE 1
+#include "m61.hh"
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+// m61bench: Allocator microbenchmarks. Runs standard workloads against m61
+// and the system allocator and prints ops/sec, per-call latency
+// percentiles, and maximum RSS as JSON.
+
+
+// Allocators
+//    Workloads call allocators through `bench_allocator`, so m61 and the
+//    system allocator pay the same indirection. `site` is passed to m61 as
+//    the allocation's line number, so heavy-hitter tracking sees several
+//    sites. Allocators without batch calls loop over single calls.
+//    `heap_stats` is null for allocators that cannot describe their heaps.
+
+struct bench_allocator {
+    const char* name;
+    void* (*malloc)(size_t sz, long site);
+    void (*free)(void* ptr);
+    void* (*realloc)(void* ptr, size_t old_sz, size_t sz);
+    size_t (*malloc_batch)(size_t sz, size_t n, void** ptrs, long site);
+    void (*free_batch)(void** ptrs, size_t n);
+    void (*heap_stats)(m61_heap_stats* stats);
+};
+
+static void* m61bench_malloc(size_t sz, long site) {
+    return m61_malloc(sz, "m61bench.cc", site);
+}
+static void m61bench_free(void* ptr) {
+    m61_free(ptr, "m61bench.cc", __LINE__);
+}
+static void* m61bench_realloc(void* ptr, size_t, size_t sz) {
+    return m61_realloc(ptr, sz, "m61bench.cc", __LINE__);
+}
+static size_t m61bench_malloc_batch(size_t sz, size_t n, void** ptrs, long site) {
+    return m61_malloc_batch(sz, n, ptrs, "m61bench.cc", site);
+}
+static void m61bench_free_batch(void** ptrs, size_t n) {
+    m61_free_batch(ptrs, n, "m61bench.cc", __LINE__);
+}
+
+static void* system_malloc(size_t sz, long) {
+    return malloc(sz);
+}
+static void system_free(void* ptr) {
+    free(ptr);
+}
+static void* system_realloc(void* ptr, size_t, size_t sz) {
+    return realloc(ptr, sz);
+}
+static size_t system_malloc_batch(size_t sz, size_t n, void** ptrs, long) {
+    for (size_t i = 0; i != n; ++i) {
+        if (!(ptrs[i] = malloc(sz))) {
+            return i;
+        }
+    }
+    return n;
+}
+static void system_free_batch(void** ptrs, size_t n) {
+    for (size_t i = 0; i != n; ++i) {
+        free(ptrs[i]);
+    }
+}
+
+static const bench_allocator allocators[] = {
+    {"m61", m61bench_malloc, m61bench_free, m61bench_realloc,
+     m61bench_malloc_batch, m61bench_free_batch, m61_get_heap_stats},
+    {"system", system_malloc, system_free, system_realloc,
+     system_malloc_batch, system_free_batch, nullptr}
+};
+
+
+// Runs
+//    A workload makes all its allocator calls through a `bench_run`. Each
+//    workload runs twice: untimed, to measure throughput, and then with
+//    every call timed, to measure latency. Workloads call `checkpoint`
+//    when many blocks are live; in the timed run, where the heap walk does
+//    not count, it records the heap of the biggest checkpoint.
+
+using bench_clock = std::chrono::steady_clock;
+static uint64_t clock_overhead_ns;
+
+static inline uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        bench_clock::now().time_since_epoch()
+    ).count();
+}
+
+struct bench_run {
+    const bench_allocator* a;
+    bool timed;
+    unsigned long long ops = 0;
+    std::vector<uint32_t> latency;      // ns per call, if `timed`
+    std::vector<uint32_t> free_latency; // ns per free call, if `timed`
+    m61_heap_stats peak_heap = {};      // heap at the biggest checkpoint
+
+    bench_run(const bench_allocator* a_, bool timed_, size_t expected_ops)
+        : a(a_), timed(timed_) {
+        if (timed) {
+            latency.reserve(expected_ops);
+            free_latency.reserve(expected_ops / 2);
+        }
+    }
+
+    // Record the latency of a call that started at `start`, per block if
+    // it handled `n` blocks. Frees are also recorded in `free_latency`.
+    void record(uint64_t start, size_t n = 1, bool is_free = false) {
+        uint64_t delta = now_ns() - start;
+        delta = delta > clock_overhead_ns ? delta - clock_overhead_ns : 0;
+        delta /= std::max(n, size_t(1));
+        uint32_t ns = uint32_t(std::min(delta, uint64_t(UINT32_MAX)));
+        latency.push_back(ns);
+        if (is_free) {
+            free_latency.push_back(ns);
+        }
+    }
+    void checkpoint() {
+        if (timed && a->heap_stats) {
+            m61_heap_stats stats;
+            a->heap_stats(&stats);
+            if (stats.heap_size >= peak_heap.heap_size) {
+                peak_heap = stats;
+            }
+        }
+    }
+    void* malloc(size_t sz, long site = 0) {
+        ++ops;
+        if (!timed) {
+            return a->malloc(sz, site);
+        }
+        uint64_t start = now_ns();
+        void* ptr = a->malloc(sz, site);
+        record(start);
+        return ptr;
+    }
+    void free(void* ptr) {
+        ++ops;
+        if (!timed) {
+            return a->free(ptr);
+        }
+        uint64_t start = now_ns();
+        a->free(ptr);
+        record(start, 1, true);
+    }
+    void* realloc(void* ptr, size_t old_sz, size_t sz) {
+        ++ops;
+        if (!timed) {
+            return a->realloc(ptr, old_sz, sz);
+        }
+        uint64_t start = now_ns();
+        void* nptr = a->realloc(ptr, old_sz, sz);
+        record(start);
+        return nptr;
+    }
+    size_t malloc_batch(size_t sz, size_t n, void** ptrs, long site = 0) {
+        ops += n;
+        if (!timed) {
+            return a->malloc_batch(sz, n, ptrs, site);
+        }
+        uint64_t start = now_ns();
+        size_t k = a->malloc_batch(sz, n, ptrs, site);
+        record(start, n);
+        return k;
+    }
+    void free_batch(void** ptrs, size_t n) {
+        ops += n;
+        if (!timed) {
+            return a->free_batch(ptrs, n);
+        }
+        uint64_t start = now_ns();
+        a->free_batch(ptrs, n);
+        record(start, n, true);
+    }
+};
+
+// A fast random number generator (xorshift64*), so workloads spend their
+// time in the allocator.
+struct bench_random {
+    uint64_t x;
+    explicit bench_random(uint64_t seed)
+        : x(seed * 0x9E3779B97F4A7C15ULL | 1) {
+    }
+    uint64_t operator()() {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        return x * 0x2545F4914F6CDD1DULL;
+    }
+    // Return a random number in [0, n).
+    uint64_t below(uint64_t n) {
+        return (*this)() % n;
+    }
+};
+
+
+// Workloads
+
+// hhtest: hhtest's skewed phases. Each call frees the previous block and
+// allocates one from one of 40 sites with hhtest's sizes; phases skew the
+// site distribution by 0, 1, and 4.
+static const size_t hhtest_sizes[40] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 2, 4, 8, 16, 32, 64,
+    128, 256, 512, 1024, 2048, 4096, 8192, 10000, 12000, 14000
+};
+
+static void workload_hhtest(bench_run& r, unsigned long long n) {
+    bench_random rand(1);
+    void* ptr = nullptr;
+    for (double skew : {0.0, 1.0, 4.0}) {
+        uint64_t limit[40];
+        double sum_p = 0, ppos = 0;
+        for (int i = 0; i != 40; ++i) {
+            sum_p += pow(0.5, i * skew);
+        }
+        for (int i = 0; i != 40; ++i) {
+            ppos += pow(0.5, i * skew);
+            limit[i] = uint64_t(double(UINT32_MAX) * (ppos / sum_p));
+        }
+        for (unsigned long long i = 0; i != n / 6; ++i) {
+            uint64_t x = rand() >> 32;
+            int site = 0;
+            while (site != 39 && x > limit[site]) {
+                ++site;
+            }
+            r.free(ptr);
+            ptr = r.malloc(hhtest_sizes[site], site);
+        }
+        r.checkpoint();
+    }
+    r.free(ptr);
+}
+
+// churn: 4096 live 64-byte blocks; each step frees a random block and
+// replaces it.
+static void workload_churn(bench_run& r, unsigned long long n) {
+    bench_random rand(2);
+    std::vector<void*> pool(4096);
+    for (auto& ptr : pool) {
+        ptr = r.malloc(64);
+    }
+    for (unsigned long long i = 0; i < n / 2; ++i) {
+        size_t j = rand.below(pool.size());
+        r.free(pool[j]);
+        pool[j] = r.malloc(64);
+    }
+    r.checkpoint();
+    for (auto ptr : pool) {
+        r.free(ptr);
+    }
+}
+
+// prodcons: A producer thread allocates blocks of 16-512 bytes and passes
+// them through a bounded queue to a consumer thread, which frees them; so
+// every free comes from a thread other than the allocating one.
+static void workload_prodcons(bench_run& r, unsigned long long n) {
+    static constexpr size_t qsize = 4096;
+    std::vector<std::atomic<void*>> queue(qsize);
+    for (auto& slot : queue) {
+        slot.store(nullptr, std::memory_order_relaxed);
+    }
+    unsigned long long count = n / 2;
+    bench_run consumer_run(r.a, r.timed, r.timed ? count : 0);
+
+    std::thread consumer([&] () {
+        for (unsigned long long i = 0; i != count; ++i) {
+            auto& slot = queue[i % qsize];
+            void* ptr;
+            while (!(ptr = slot.load(std::memory_order_acquire))) {
+                std::this_thread::yield();
+            }
+            slot.store(nullptr, std::memory_order_relaxed);
+            consumer_run.free(ptr);
+        }
+    });
+    bench_random rand(3);
+    for (unsigned long long i = 0; i != count; ++i) {
+        auto& slot = queue[i % qsize];
+        void* ptr = r.malloc(16 + rand.below(497));
+        while (slot.load(std::memory_order_relaxed)) {
+            std::this_thread::yield();
+        }
+        slot.store(ptr, std::memory_order_release);
+    }
+    r.checkpoint();
+    consumer.join();
+
+    r.ops += consumer_run.ops;
+    r.latency.insert(r.latency.end(), consumer_run.latency.begin(),
+                     consumer_run.latency.end());
+    r.free_latency.insert(r.free_latency.end(),
+                          consumer_run.free_latency.begin(),
+                          consumer_run.free_latency.end());
+}
+
+// realloc: 16 vectors grow by half their capacity at a time, from 16 bytes
+// to 256 KiB, writing each new element, then start over.
+static void workload_realloc(bench_run& r, unsigned long long n) {
+    struct vec {
+        char* data = nullptr;
+        size_t size = 0;
+        size_t capacity = 0;
+    } vs[16];
+    for (unsigned long long i = 0; i < n; ) {
+        vec& v = vs[i % 16];
+        if (v.capacity >= 256 * 1024) {
+            r.free(v.data);
+            v = vec();
+        } else {
+            size_t ncap = v.capacity ? v.capacity + v.capacity / 2 : 16;
+            v.data = reinterpret_cast<char*>(r.realloc(v.data, v.capacity, ncap));
+            memset(v.data + v.size, 1, ncap - v.size);
+            v.size = v.capacity = ncap;
+        }
+        i = r.ops;
+    }
+    r.checkpoint();
+    for (auto& v : vs) {
+        r.free(v.data);
+    }
+}
+
+// frag: Rounds of allocating blocks with log-uniform sizes (16 bytes to
+// 32 KiB), then freeing a random half of all live blocks, so later,
+// bigger rounds must fit between survivors of earlier rounds.
+static void workload_frag(bench_run& r, unsigned long long n) {
+    bench_random rand(4);
+    std::vector<void*> live;
+    live.reserve(n);
+    unsigned long long per_round = std::max(n / 16, 1ULL);
+    for (int round = 0; round != 8; ++round) {
+        for (unsigned long long i = 0; i != per_round; ++i) {
+            unsigned shift = 4 + rand.below(8 + round / 2);
+            size_t sz = (size_t(1) << shift) + rand.below(size_t(1) << shift);
+            void* ptr = r.malloc(sz, round);
+            if (ptr) {
+                memset(ptr, 0, std::min(sz, size_t(64)));
+                live.push_back(ptr);
+            }
+        }
+        for (size_t i = 0; i < live.size(); ) {
+            if (rand.below(2)) {
+                r.free(live[i]);
+                live[i] = live.back();
+                live.pop_back();
+            } else {
+                ++i;
+            }
+        }
+        r.checkpoint();
+    }
+    for (auto ptr : live) {
+        r.free(ptr);
+    }
+}
+
+// batch: 16 groups of 64 live 64-byte blocks; each step frees a random
+// group and allocates it again, with one batch call each.
+// batchloop: The same, with one call per block.
+static void batch_groups(bench_run& r, unsigned long long n, bool batched) {
+    static constexpr size_t ngroups = 16, group_size = 64;
+    bench_random rand(5);
+    std::vector<void*> groups(ngroups * group_size);
+    for (size_t g = 0; g != ngroups; ++g) {
+        r.malloc_batch(64, group_size, &groups[g * group_size]);
+    }
+    while (r.ops < n) {
+        void** group = &groups[rand.below(ngroups) * group_size];
+        if (batched) {
+            r.free_batch(group, group_size);
+            r.malloc_batch(64, group_size, group);
+        } else {
+            for (size_t i = 0; i != group_size; ++i) {
+                r.free(group[i]);
+            }
+            for (size_t i = 0; i != group_size; ++i) {
+                group[i] = r.malloc(64);
+            }
+        }
+    }
+    r.checkpoint();
+    r.free_batch(groups.data(), groups.size());
+}
+
+static void workload_batch(bench_run& r, unsigned long long n) {
+    batch_groups(r, n, true);
+}
+
+static void workload_batchloop(bench_run& r, unsigned long long n) {
+    batch_groups(r, n, false);
+}
+
+struct bench_workload {
+    const char* name;
+    void (*run)(bench_run& r, unsigned long long n);
+    unsigned long long ops;     // approximate # calls at scale 1
+};
+
+static const bench_workload workloads[] = {
+    {"hhtest", workload_hhtest, 2000000},
+    {"churn", workload_churn, 2000000},
+    {"prodcons", workload_prodcons, 1000000},
+    {"realloc", workload_realloc, 500000},
+    {"frag", workload_frag, 1000000},
+    {"batch", workload_batch, 2000000},
+    {"batchloop", workload_batchloop, 2000000}
+};
+
+
+// Results
+//    Each workload runs in a child process, so it starts from a fresh heap
+//    and its maximum RSS is its own.
+
+struct bench_result {
+    unsigned long long ops;
+    double seconds;
+    uint32_t p50_ns;
+    uint32_t p99_ns;
+    uint32_t free_p50_ns;
+    uint32_t free_p99_ns;
+    long max_rss_kb;
+    m61_heap_stats heap;        // heap at the biggest checkpoint, if known
+    bool ok;
+};
+
+static uint32_t percentile(std::vector<uint32_t>& v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+    size_t k = std::min(size_t(double(v.size()) * p), v.size() - 1);
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+static void calibrate_clock() {
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i != 10000; ++i) {
+        uint64_t start = now_ns();
+        best = std::min(best, now_ns() - start);
+    }
+    clock_overhead_ns = best;
+}
+
+// run_workload(a, w, scale, redzone)
+//    Run `w` with allocator `a` in a child process. If `redzone` is
+//    nonnegative, the child runs m61 with `M61_REDZONE=redzone`.
+static bench_result run_workload(const bench_allocator* a, const bench_workload* w,
+                                 double scale, long redzone) {
+    auto result = reinterpret_cast<bench_result*>(
+        mmap(nullptr, sizeof(bench_result), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0)
+    );
+    if (result == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    memset(result, 0, sizeof(*result));
+    unsigned long long n = std::max(1ULL, (unsigned long long) (double(w->ops) * scale));
+
+    pid_t p = fork();
+    if (p == 0) {
+        if (redzone >= 0) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%ld", redzone);
+            setenv("M61_REDZONE", buf, 1);
+        }
+        {
+            bench_run r(a, false, 0);
+            auto start = bench_clock::now();
+            w->run(r, n);
+            std::chrono::duration<double> delta = bench_clock::now() - start;
+            result->ops = r.ops;
+            result->seconds = delta.count();
+        }
+        {
+            bench_run r(a, true, n + n / 8);
+            w->run(r, n);
+            result->p50_ns = percentile(r.latency, 0.5);
+            result->p99_ns = percentile(r.latency, 0.99);
+            result->free_p50_ns = percentile(r.free_latency, 0.5);
+            result->free_p99_ns = percentile(r.free_latency, 0.99);
+            result->heap = r.peak_heap;
+        }
+        result->ok = true;
+        _exit(0);
+    }
+    int status;
+    struct rusage ru;
+    if (p < 0 || wait4(p, &status, 0, &ru) != p
+        || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        result->ok = false;
+    } else {
+        result->max_rss_kb = ru.ru_maxrss;
+    }
+    bench_result copy = *result;
+    munmap(result, sizeof(bench_result));
+    return copy;
+}
+
+
+int main(int argc, char** argv) {
+    base_allocator_disable(1);
+
+    const char* which_allocator = nullptr;
+    const char* which_workload = nullptr;
+    double scale = 1;
+    std::vector<long> redzones;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:w:n:z:h")) != -1) {
+        if (opt == 'a') {
+            which_allocator = optarg;
+        } else if (opt == 'w') {
+            which_workload = optarg;
+        } else if (opt == 'n') {
+            scale = strtod(optarg, nullptr);
+        } else if (opt == 'z') {
+            for (char* s = optarg; *s; ) {
+                redzones.push_back(strtol(s, &s, 0));
+                s += *s == ',';
+            }
+        } else {
+            fprintf(opt == 'h' ? stdout : stderr,
+                    "Usage: ./m61bench [-a ALLOCATOR] [-w WORKLOAD] [-n SCALE] [-z WIDTHS]\n\
+\n\
+  Runs allocator workloads and prints results as JSON. ALLOCATOR is m61\n\
+  or system (default both). WORKLOAD is hhtest, churn, prodcons, realloc,\n\
+  frag, batch, or batchloop (default all); batch uses the batch calls and\n\
+  batchloop the same pattern of single calls. Batch calls report latency\n\
+  per block. SCALE multiplies the number of operations.\n\
+  WIDTHS, a comma-separated list like 0,16,256, runs m61 once per trailing\n\
+  redzone width, to measure the cost of filling and checking redzones.\n\
+  Each result reports ops/sec from an untimed run, then p50 and p99 per-call\n\
+  latency from a run with every call timed (less measured clock overhead),\n\
+  the same for free calls alone (free_p50_ns and free_p99_ns; m61 fills\n\
+  redzones on malloc and checks them on free), and the maximum RSS of the\n\
+  process running the workload. m61 results also describe the heap when\n\
+  it was biggest: its size, the bytes in active blocks, and its free-span\n\
+  and external fragmentation (see m61.hh).\n");
+            exit(opt == 'h' ? 0 : 1);
+        }
+    }
+    calibrate_clock();
+
+    bool first = true, any = false;
+    printf("[");
+    for (auto& w : workloads) {
+        if (which_workload && strcmp(which_workload, w.name) != 0) {
+            continue;
+        }
+        for (auto& a : allocators) {
+            if (which_allocator && strcmp(which_allocator, a.name) != 0) {
+                continue;
+            }
+            any = true;
+            bool is_m61 = a.malloc == m61bench_malloc;
+            size_t nruns = is_m61 && !redzones.empty() ? redzones.size() : 1;
+            for (size_t i = 0; i != nruns; ++i) {
+                long redzone = is_m61 && !redzones.empty() ? redzones[i] : -1;
+                bench_result r = run_workload(&a, &w, scale, redzone);
+                printf("%s\n  {\"workload\": \"%s\", \"allocator\": \"%s\", ",
+                       first ? "" : ",", w.name, a.name);
+                if (redzone >= 0) {
+                    printf("\"redzone\": %ld, ", redzone);
+                }
+                if (r.ok) {
+                    printf("\"ops\": %llu, \"seconds\": %.6f, \"ops_per_sec\": %.0f, "
+                           "\"p50_ns\": %u, \"p99_ns\": %u, \"free_p50_ns\": %u, "
+                           "\"free_p99_ns\": %u, \"max_rss_kb\": %ld",
+                           r.ops, r.seconds, r.seconds > 0 ? r.ops / r.seconds : 0.0,
+                           r.p50_ns, r.p99_ns, r.free_p50_ns, r.free_p99_ns,
+                           r.max_rss_kb);
+                    if (r.heap.heap_size) {
+                        printf(",\n   \"heap_kb\": %llu, \"heap_active_kb\": %llu, "
+                               "\"free_span_frag\": %.4f, \"external_frag\": %.4f",
+                               r.heap.heap_size >> 10, r.heap.active_size >> 10,
+                               r.heap.free_span_fragmentation,
+                               r.heap.external_fragmentation);
+                    }
+                    printf("}");
+                } else {
+                    printf("\"error\": \"workload failed\"}");
+                }
+                fflush(stdout);
+                first = false;
+            }
+        }
+    }
+    printf("\n]\n");
+    if (!any) {
+        fprintf(stderr, "m61bench: no such allocator or workload\n");
+        exit(1);
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef M61EXPORT_HH
+#define M61EXPORT_HH 1
+#include "m61.hh"
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// m61 stats export
+//    With `M61_EXPORT=1`, a background thread publishes m61's statistics
+//    and heaviest allocation sites every `M61_EXPORT_MS` milliseconds
+//    (default 1000) in the POSIX shared memory object `/m61.PID`, which
+//    `m61top` watches. The object is an `m61_export_header`, readable only
+//    by the process's user, and is unlinked at exit.
+//
+//    The data is protected by a seqlock. The publisher makes `seq` odd,
+//    writes `data`, and makes `seq` even again; a reader copies `data` and
+//    retries if `seq` was odd or changed meanwhile. Readers never write to
+//    the object, so watching a process cannot slow its allocator, and a
+//    read costs one copy of a few kilobytes.
+
+#define M61_EXPORT_MAGIC "M61STATS"
+#define M61_EXPORT_VERSION 1
+
+static constexpr unsigned m61_export_nsites = 16;
+static constexpr size_t m61_export_name_size = 112;
+
+struct m61_export_site {
+    char name[m61_export_name_size];    // site file or stack, truncated
+    int64_t line;
+    uint64_t count;             // # allocations (estimated if sampling)
+    uint64_t size;              // # bytes allocated (estimated if sampling)
+};
+
+struct m61_export_data {
+    uint64_t time;              // publication time, `steady_clock` ns
+    m61_statistics stats;
+    uint64_t hh_total;          // # bytes allocated, as tracked by sites
+    uint32_t nsites;            // # entries in `sites`
+    m61_export_site sites[m61_export_nsites];   // heaviest by bytes first
+};
+
+struct m61_export_header {
+    char magic[8];              // `M61_EXPORT_MAGIC`
+    uint32_t version;           // `M61_EXPORT_VERSION`
+    uint32_t pid;
+    uint64_t interval;          // ns between publications
+    std::atomic<uint64_t> seq;  // # publications started, times 2; odd
+                                // while one is in progress
+    m61_export_data data;
+};
+
+// m61_export_read(hdr, data)
+//    Copy a consistent version of `hdr->data` into `*data`. Returns false
+//    if `hdr` is not a stats export, or if the publisher stays mid-update
+//    (perhaps because its process died).
+inline bool m61_export_read(const m61_export_header* hdr, m61_export_data* data) {
+    if (memcmp(hdr->magic, M61_EXPORT_MAGIC, sizeof(hdr->magic)) != 0
+        || hdr->version != M61_EXPORT_VERSION) {
+        return false;
+    }
+    for (int tries = 0; tries != 1000; ++tries) {
+        uint64_t seq = hdr->seq.load(std::memory_order_acquire);
+        if (seq % 2 == 0) {
+            memcpy(data, &hdr->data, sizeof(*data));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (hdr->seq.load(std::memory_order_relaxed) == seq) {
+                return seq != 0;
+            }
+        }
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,309 @@
+#define M61_DISABLE 1
+#include "m61hh.hh"
+#include <algorithm>
+#include <cstring>
+
+// The summary is a binary min-heap of entries (so the lightest entry, the
+// one `add` evicts, is `heap_[0]`), indexed by an open-addressed hash table
+// with linear probing. Each entry remembers its hash slot so heap moves can
+// update the table.
+
+m61_hh_summary::m61_hh_summary()
+    : n_(0), total_(0), floor_(0) {
+    memset(slot_, -1, sizeof(slot_));
+}
+
+inline unsigned m61_hh_summary::hash(const char* file, long line) {
+    uint64_t h = reinterpret_cast<uintptr_t>(file) * 0x9E3779B97F4A7C15ULL;
+    h ^= uint64_t(line) * 0xC2B2AE3D27D4EB4FULL;
+    return (h >> 32) & (nslots - 1);
+}
+
+inline int m61_hh_summary::find(const char* file, long line) const {
+    for (unsigned i = hash(file, line); slot_[i] >= 0; i = (i + 1) & (nslots - 1)) {
+        int pos = slot_[i];
+        if (heap_[pos].file == file && heap_[pos].line == line) {
+            return pos;
+        }
+    }
+    return -1;
+}
+
+static inline void saturating_add(uint32_t& ctr, unsigned long long n) {
+    ctr = n < UINT32_MAX - ctr ? ctr + n : UINT32_MAX;
+}
+
+unsigned long long m61_hh_summary::floor() const {
+    unsigned long long min = n_ == capacity ? heap_[0].weight : 0;
+    return std::max(floor_, min);
+}
+
+inline void m61_hh_summary::place(int pos, const entry& e) {
+    heap_[pos] = e;
+    slot_[e.hslot] = pos;
+}
+
+void m61_hh_summary::sift_up(int pos) {
+    entry e = heap_[pos];
+    while (pos > 0 && heap_[(pos - 1) / 2].weight > e.weight) {
+        place(pos, heap_[(pos - 1) / 2]);
+        pos = (pos - 1) / 2;
+    }
+    place(pos, e);
+}
+
+void m61_hh_summary::sift_down(int pos) {
+    entry e = heap_[pos];
+    while (2 * pos + 1 < n_) {
+        int child = 2 * pos + 1;
+        if (child + 1 < n_ && heap_[child + 1].weight < heap_[child].weight) {
+            ++child;
+        }
+        if (heap_[child].weight >= e.weight) {
+            break;
+        }
+        place(pos, heap_[child]);
+        pos = child;
+    }
+    place(pos, e);
+}
+
+void m61_hh_summary::hash_insert(int pos) {
+    unsigned i = heap_[pos].home;
+    while (slot_[i] >= 0) {
+        i = (i + 1) & (nslots - 1);
+    }
+    slot_[i] = pos;
+    heap_[pos].hslot = i;
+}
+
+// hash_erase(slot)
+//    Remove hash slot `slot`, shifting later entries in its probe sequence
+//    backward so lookups never need tombstones.
+void m61_hh_summary::hash_erase(unsigned slot) {
+    unsigned hole = slot;
+    slot_[hole] = -1;
+    for (unsigned j = (hole + 1) & (nslots - 1);
+         slot_[j] >= 0;
+         j = (j + 1) & (nslots - 1)) {
+        unsigned home = heap_[slot_[j]].home;
+        // entry at `j` may move to `hole` unless its home is cyclically
+        // in (hole, j]
+        bool stays = hole <= j ? hole < home && home <= j
+            : hole < home || home <= j;
+        if (!stays) {
+            slot_[hole] = slot_[j];
+            heap_[slot_[hole]].hslot = hole;
+            slot_[j] = -1;
+            hole = j;
+        }
+    }
+}
+
+void m61_hh_summary::add(const char* file, long line, unsigned long long w,
+                         unsigned size_bucket, unsigned long long n) {
+    total_ += w;
+    int pos = find(file, line);
+    if (pos >= 0) {
+        saturating_add(size_hist_[heap_[pos].hist][size_bucket], n);
+        heap_[pos].weight += w;
+        sift_down(pos);
+        return;
+    }
+    // New site: it inherits the weight bound of untracked sites, and the
+    // histograms of the site it evicts, cleared.
+    unsigned long long base = floor();
+    uint16_t hist;
+    if (n_ < capacity) {
+        pos = hist = n_++;
+    } else {
+        pos = 0;
+        hist = heap_[0].hist;
+        hash_erase(heap_[0].hslot);
+    }
+    heap_[pos] = {file, line, base + w, base, uint16_t(hash(file, line)), 0, hist};
+    memset(size_hist_[hist], 0, sizeof(size_hist_[hist]));
+    memset(lifetime_hist_[hist], 0, sizeof(lifetime_hist_[hist]));
+    saturating_add(size_hist_[hist][size_bucket], n);
+    hash_insert(pos);
+    if (pos == 0) {
+        sift_down(0);
+    } else {
+        sift_up(pos);
+    }
+}
+
+void m61_hh_summary::add_lifetime(const char* file, long line, unsigned bucket,
+                                  unsigned long long n) {
+    int pos = find(file, line);
+    if (pos >= 0) {
+        saturating_add(lifetime_hist_[heap_[pos].hist][bucket], n);
+    }
+}
+
+void m61_hh_summary::rebuild(const entry* es, int n) {
+    memset(slot_, -1, sizeof(slot_));
+    n_ = n;
+    for (int i = 0; i != n; ++i) {
+        heap_[i] = es[i];
+        heap_[i].home = hash(es[i].file, es[i].line);
+    }
+    for (int i = n / 2 - 1; i >= 0; --i) {
+        // heapify without the hash table, which is filled in below
+        entry e = heap_[i];
+        int pos = i;
+        while (2 * pos + 1 < n) {
+            int child = 2 * pos + 1;
+            if (child + 1 < n && heap_[child + 1].weight < heap_[child].weight) {
+                ++child;
+            }
+            if (heap_[child].weight >= e.weight) {
+                break;
+            }
+            heap_[pos] = heap_[child];
+            pos = child;
+        }
+        heap_[pos] = e;
+    }
+    for (int i = 0; i != n; ++i) {
+        hash_insert(i);
+    }
+}
+
+namespace {
+struct merge_candidate {
+    const char* file;
+    long line;
+    unsigned long long hi[2];   // sum of upper bounds from each side
+    unsigned long long lo[2];   // sum of lower bounds from each side
+    bool present[2];
+    int hist[2];                // histogram index on each side, or -1
+};
+}
+
+void m61_hh_summary::merge(const m61_hh_summary& other) {
+    merge_candidate cands[2 * capacity];
+    int ncands = 0;
+    // `other`'s histograms for one site, as a list from `cands[c].hist[1]`
+    int other_next[capacity];
+    const m61_hh_summary* sides[2] = {this, &other};
+    for (int side = 0; side != 2; ++side) {
+        for (int i = 0; i != sides[side]->n_; ++i) {
+            const entry& e = sides[side]->heap_[i];
+            // sites match by name, since one file name may have several
+            // addresses
+            int c = 0;
+            while (c != ncands
+                   && (cands[c].line != e.line
+                       || (cands[c].file != e.file
+                           && strcmp(cands[c].file, e.file) != 0))) {
+                ++c;
+            }
+            if (c == ncands) {
+                cands[ncands++] = {e.file, e.line, {0, 0}, {0, 0}, {false, false},
+                                   {-1, -1}};
+            }
+            cands[c].hi[side] += e.weight;
+            cands[c].lo[side] += e.weight - e.error;
+            cands[c].present[side] = true;
+            // a site named by several entries on one side gets all their
+            // histograms: ours are added into the first entry's, whose
+            // index the site keeps, and `other`'s are listed
+            int h = cands[c].hist[side];
+            if (side == 0 && h >= 0) {
+                for (int b = 0; b != nbuckets; ++b) {
+                    saturating_add(size_hist_[h][b], size_hist_[e.hist][b]);
+                    saturating_add(lifetime_hist_[h][b], lifetime_hist_[e.hist][b]);
+                }
+            } else {
+                if (side == 1) {
+                    other_next[e.hist] = h;
+                }
+                cands[c].hist[side] = e.hist;
+            }
+        }
+    }
+
+    unsigned long long floors[2] = {floor(), other.floor()};
+    entry es[2 * capacity];
+    for (int c = 0; c != ncands; ++c) {
+        unsigned long long hi = 0, lo = 0;
+        for (int side = 0; side != 2; ++side) {
+            hi += cands[c].present[side] ? cands[c].hi[side] : floors[side];
+            lo += cands[c].lo[side];
+        }
+        // `hist` holds the candidate index until histograms are placed
+        es[c] = {cands[c].file, cands[c].line, hi, hi - lo, 0, 0, uint16_t(c)};
+    }
+    std::sort(es, es + ncands, [] (const entry& a, const entry& b) {
+        return a.weight > b.weight;
+    });
+
+    unsigned long long new_floor = floors[0] + floors[1];
+    if (ncands > capacity) {
+        new_floor = std::max(new_floor, es[capacity].weight);
+        ncands = capacity;
+    }
+
+    // Place the kept sites' histograms at indexes [0, ncands). A site
+    // tracked here keeps its index if it is in range; the others take
+    // indexes no kept site uses yet, so nothing is overwritten before it
+    // is read.
+    bool pinned[capacity] = {};
+    for (int i = 0; i != ncands; ++i) {
+        int h = cands[es[i].hist].hist[0];
+        if (h >= 0 && h < ncands) {
+            pinned[h] = true;
+        }
+    }
+    int next_free = 0;
+    for (int i = 0; i != ncands; ++i) {
+        const merge_candidate& c = cands[es[i].hist];
+        int h = c.hist[0];
+        if (h < 0 || h >= ncands) {
+            while (pinned[next_free]) {
+                ++next_free;
+            }
+            int nh = next_free++;
+            if (h >= 0) {
+                memcpy(size_hist_[nh], size_hist_[h], sizeof(size_hist_[nh]));
+                memcpy(lifetime_hist_[nh], lifetime_hist_[h], sizeof(lifetime_hist_[nh]));
+            } else {
+                memset(size_hist_[nh], 0, sizeof(size_hist_[nh]));
+                memset(lifetime_hist_[nh], 0, sizeof(lifetime_hist_[nh]));
+            }
+            h = nh;
+        }
+        for (int oh = c.hist[1]; oh >= 0; oh = other_next[oh]) {
+            for (int b = 0; b != nbuckets; ++b) {
+                saturating_add(size_hist_[h][b], other.size_hist_[oh][b]);
+                saturating_add(lifetime_hist_[h][b], other.lifetime_hist_[oh][b]);
+            }
+        }
+        es[i].hist = h;
+    }
+    rebuild(es, ncands);
+    total_ += other.total_;
+    floor_ = new_floor;
+}
+
+void m61_hh_summary::get(m61_heavy_hitter_summary* out) const {
+    out->total = total_;
+    out->floor = floor();
+    out->n = n_;
+    for (int i = 0; i != n_; ++i) {
+        m61_heavy_hitter& hh = out->hh[i];
+        hh.file = heap_[i].file;
+        hh.line = heap_[i].line;
+        hh.weight = heap_[i].weight;
+        hh.error = heap_[i].error;
+        for (int b = 0; b != nbuckets; ++b) {
+            hh.size_hist[b] = size_hist_[heap_[i].hist][b];
+            hh.lifetime_hist[b] = lifetime_hist_[heap_[i].hist][b];
+        }
+    }
+    std::sort(out->hh, out->hh + n_,
+              [] (const m61_heavy_hitter& a, const m61_heavy_hitter& b) {
+                  return a.weight > b.weight;
+              });
+}
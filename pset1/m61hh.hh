@@ -0,0 +1,88 @@
+#ifndef M61HH_HH
+#define M61HH_HH 1
+#include "m61.hh"
+#include <cstdint>
+#include <cstddef>
+
+// m61_hh_summary
+//    A bounded "Space-Saving" summary of allocation sites (Metwally,
+//    Agrawal, and El Abbadi, 2005), weighted either by allocation count or
+//    by bytes. It tracks at most `capacity` sites in fixed memory, no
+//    matter how many sites a program has.
+//
+//    Guarantees: Every tracked site's `weight` is an upper bound on its
+//    true weight, and `weight - error` is a lower bound. Every untracked
+//    site's true weight is at most `floor()`. For a summary built only by
+//    `add`, `error` and `floor()` are at most W / capacity, where W is
+//    the total weight added; so any site weighing more than W / capacity
+//    is always tracked. `merge` combines summaries (e.g., from different
+//    threads) and keeps the bounds sound: errors and floors add.
+//
+//    Each tracked site also has a log2 histogram of its allocation sizes
+//    and one of its blocks' lifetimes. A site's histograms count only
+//    events since it was last (re)admitted to the summary, and lifetimes
+//    are only counted for sites tracked when their blocks are freed.
+
+class m61_hh_summary {
+public:
+    static constexpr int capacity = M61_HH_CAPACITY;
+
+    m61_hh_summary();
+
+    // Charge `w` to the site `file`:`line` for `n` allocations in size
+    // bucket `size_bucket`.
+    void add(const char* file, long line, unsigned long long w,
+             unsigned size_bucket, unsigned long long n = 1);
+
+    // Count `n` frees of blocks from `file`:`line` in lifetime bucket
+    // `bucket`, if the site is tracked.
+    void add_lifetime(const char* file, long line, unsigned bucket,
+                      unsigned long long n = 1);
+
+    // Fold `other` into this summary, keeping the `capacity` heaviest sites.
+    void merge(const m61_hh_summary& other);
+
+    // Total weight added, including weight from merged summaries.
+    unsigned long long total() const {
+        return total_;
+    }
+    // Upper bound on the weight of any untracked site.
+    unsigned long long floor() const;
+
+    // Store the tracked sites in `out`, heaviest first.
+    void get(m61_heavy_hitter_summary* out) const;
+
+private:
+    struct entry {
+        const char* file;
+        long line;
+        unsigned long long weight;
+        unsigned long long error;
+        uint16_t home;          // preferred hash slot
+        uint16_t hslot;         // actual hash slot
+        uint16_t hist;          // index in `size_hist_` and `lifetime_hist_`
+    };
+    static constexpr unsigned nslots = 2 * capacity;
+    static constexpr int nbuckets = M61_HH_NBUCKETS;
+
+    entry heap_[capacity];      // min-heap ordered by `weight`
+    int n_;
+    int16_t slot_[nslots];      // hash slot -> `heap_` index, or -1
+    // Histograms stay put while entries move in the heap. Entries use
+    // histogram indexes [0, n_). Counts saturate.
+    uint32_t size_hist_[capacity][nbuckets];
+    uint32_t lifetime_hist_[capacity][nbuckets];
+    unsigned long long total_;
+    unsigned long long floor_;  // absent-site bound carried from merges
+
+    static unsigned hash(const char* file, long line);
+    int find(const char* file, long line) const;
+    void place(int pos, const entry& e);
+    void sift_up(int pos);
+    void sift_down(int pos);
+    void hash_insert(int pos);
+    void hash_erase(unsigned slot);
+    void rebuild(const entry* es, int n);
+};
+
+#endif
@@ -0,0 +1,364 @@
+#define M61_DISABLE 1
+#include "m61.hh"
+#include "m61stack.hh"
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <algorithm>
+#include <new>
+#include <dlfcn.h>
+#include <unistd.h>
+// libm61.so: m61 as a replacement for the system allocator, for programs
+// that were not compiled against m61.hh. Run a program with
+// `LD_PRELOAD=./libm61.so PROGRAM` to route its malloc family and C++
+// operator new/delete through m61.
+//
+// Allocations have no `__FILE__` and `__LINE__`, so each allocation site is
+// named by its call stack, found by walking frame pointers (see
+// m61stack.hh). Frees are named by their return address alone. Reports
+// print each stack's frames as `function+offset (object)`, or as
+// `object+offset` for code without symbols. Code built without frame
+// pointers cuts stacks short.
+//
+// At exit, libm61.so prints reports to stderr. `M61_REPORT` lists them,
+// separated by commas: `stats`, `hh` (heavy hitters), `hh-json` (heavy
+// hitters with their histograms, as JSON), and `leaks`. Without
+// `M61_REPORT`, nothing is printed, so a preloaded program's stderr is
+// unchanged.
+
+extern "C" {
+void* __libc_malloc(size_t sz);
+void __libc_free(void* ptr);
+void* __libc_calloc(size_t nmemb, size_t sz);
+void* __libc_realloc(void* ptr, size_t sz);
+void* __libc_memalign(size_t align, size_t sz);
+}
+
+
+// Base allocator
+//    m61 gets its chunks and metadata from the system allocator proper, not
+//    the interposed one.
+
+void* base_malloc(size_t sz) {
+    return __libc_malloc(sz);
+}
+
+void base_free(void* ptr) {
+    __libc_free(ptr);
+}
+
+void base_allocator_disable(bool) {
+}
+
+
+// Configuration
+//    Preloaded programs start other preloaded programs, which inherit
+//    `M61_TRACE`, so m61 gives each process its own trace file (see
+//    m61.cc).
+
+bool m61_preloaded() {
+    return true;
+}
+
+
+// Reentrancy
+//    m61 and the C library call the allocator themselves: m61 when a
+//    thread registers, for instance, and `dladdr`. Calls made while this
+//    thread is already inside libm61.so go straight to the system
+//    allocator. `free` and `realloc` tell the two kinds of block apart with
+//    `m61_contains`.
+
+static thread_local int preload_depth;
+
+struct preload_guard {
+    preload_guard() {
+        ++preload_depth;
+    }
+    ~preload_guard() {
+        --preload_depth;
+    }
+};
+
+
+// Call sites
+//    `alloc_site` costs a short frame-pointer walk and, unless the stack is
+//    new, one lock-free hash lookup.
+
+static inline const char* alloc_site(void* ra, void* fp) {
+    return m61_stack_site(ra, fp);
+}
+
+static inline const char* free_site(void* ra) {
+    return m61_stack_intern(&ra, 1);
+}
+
+
+// Allocation functions
+//    Each takes the caller's return address and the exported function's
+//    frame, so the exported functions below name their own callers.
+
+static void* preload_malloc(size_t sz, void* ra, void* fp) {
+    if (preload_depth) {
+        return __libc_malloc(sz);
+    }
+    preload_guard guard;
+    void* ptr = m61_malloc(sz, alloc_site(ra, fp), 0);
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+static void preload_free(void* ptr, void* ra) {
+    if (!ptr) {
+        return;
+    } else if (!m61_contains(ptr)) {
+        __libc_free(ptr);
+        return;
+    }
+    preload_guard guard;
+    m61_free(ptr, free_site(ra), 0);
+}
+
+static void* preload_calloc(size_t nmemb, size_t sz, void* ra, void* fp) {
+    if (preload_depth) {
+        return __libc_calloc(nmemb, sz);
+    }
+    preload_guard guard;
+    void* ptr = m61_calloc(nmemb, sz, alloc_site(ra, fp), 0);
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+static void* preload_realloc(void* ptr, size_t sz, void* ra, void* fp) {
+    if (ptr && !m61_contains(ptr)) {
+        return __libc_realloc(ptr, sz);
+    } else if (!ptr) {
+        return preload_malloc(sz, ra, fp);
+    }
+    preload_guard guard;
+    void* nptr = m61_realloc(ptr, sz, alloc_site(ra, fp), 0);
+    if (!nptr && sz) {
+        errno = ENOMEM;
+    }
+    return nptr;
+}
+
+static void* preload_aligned_alloc(size_t align, size_t sz, void* ra, void* fp) {
+    if (align <= 16) {
+        return preload_malloc(sz, ra, fp);
+    } else if (preload_depth) {
+        return __libc_memalign(align, sz);
+    }
+    preload_guard guard;
+    void* ptr = m61_aligned_alloc(align, sz, alloc_site(ra, fp), 0);
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+static inline bool valid_alignment(size_t align) {
+    return align != 0 && (align & (align - 1)) == 0;
+}
+
+
+extern "C" {
+
+void* malloc(size_t sz) {
+    return preload_malloc(sz, __builtin_return_address(0), __builtin_frame_address(0));
+}
+
+void free(void* ptr) {
+    preload_free(ptr, __builtin_return_address(0));
+}
+
+void* calloc(size_t nmemb, size_t sz) {
+    return preload_calloc(nmemb, sz, __builtin_return_address(0),
+                          __builtin_frame_address(0));
+}
+
+void* realloc(void* ptr, size_t sz) {
+    return preload_realloc(ptr, sz, __builtin_return_address(0),
+                           __builtin_frame_address(0));
+}
+
+int posix_memalign(void** ptrp, size_t align, size_t sz) {
+    if (!valid_alignment(align) || align % sizeof(void*) != 0) {
+        return EINVAL;
+    }
+    int saved_errno = errno;
+    void* ptr = preload_aligned_alloc(align, sz, __builtin_return_address(0),
+                                      __builtin_frame_address(0));
+    errno = saved_errno;
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *ptrp = ptr;
+    return 0;
+}
+
+void* aligned_alloc(size_t align, size_t sz) {
+    if (!valid_alignment(align)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    return preload_aligned_alloc(align, sz, __builtin_return_address(0),
+                                 __builtin_frame_address(0));
+}
+
+size_t malloc_usable_size(void* ptr) {
+    if (ptr && !m61_contains(ptr)) {
+        static auto system_usable_size = reinterpret_cast<size_t (*)(void*)>(
+            dlsym(RTLD_NEXT, "malloc_usable_size")
+        );
+        return system_usable_size ? system_usable_size(ptr) : 0;
+    }
+    return ptr ? m61_usable_size(ptr) : 0;
+}
+
+}
+
+
+// C++ operators
+
+static void* preload_new(size_t sz, size_t align, void* ra, void* fp) {
+    while (true) {
+        void* ptr = preload_aligned_alloc(align, sz, ra, fp);
+        if (ptr) {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+static void* preload_new_nothrow(size_t sz, size_t align, void* ra, void* fp) noexcept {
+    try {
+        return preload_new(sz, align, ra, fp);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new(size_t sz) {
+    return preload_new(sz, 16, __builtin_return_address(0),
+                       __builtin_frame_address(0));
+}
+void* operator new[](size_t sz) {
+    return preload_new(sz, 16, __builtin_return_address(0),
+                       __builtin_frame_address(0));
+}
+void* operator new(size_t sz, const std::nothrow_t&) noexcept {
+    return preload_new_nothrow(sz, 16, __builtin_return_address(0),
+                               __builtin_frame_address(0));
+}
+void* operator new[](size_t sz, const std::nothrow_t&) noexcept {
+    return preload_new_nothrow(sz, 16, __builtin_return_address(0),
+                               __builtin_frame_address(0));
+}
+void* operator new(size_t sz, std::align_val_t align) {
+    return preload_new(sz, size_t(align), __builtin_return_address(0),
+                       __builtin_frame_address(0));
+}
+void* operator new[](size_t sz, std::align_val_t align) {
+    return preload_new(sz, size_t(align), __builtin_return_address(0),
+                       __builtin_frame_address(0));
+}
+void* operator new(size_t sz, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return preload_new_nothrow(sz, size_t(align), __builtin_return_address(0),
+                               __builtin_frame_address(0));
+}
+void* operator new[](size_t sz, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return preload_new_nothrow(sz, size_t(align), __builtin_return_address(0),
+                               __builtin_frame_address(0));
+}
+
+void operator delete(void* ptr) noexcept {
+    preload_free(ptr, __builtin_return_address(0));
+}
+void operator delete[](void* ptr) noexcept {
+    preload_free(ptr, __builtin_return_address(0));
+}
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    preload_free(ptr, __builtin_return_address(0));
+}
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    preload_free(ptr, __builtin_return_address(0));
+}
+void operator delete(void* ptr, size_t) noexcept {
+    preload_free(ptr, __builtin_return_address(0));
+}
+void operator delete[](void* ptr, size_t) noexcept {
+    preload_free(ptr, __builtin_return_address(0));
+}
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    preload_free(ptr, __builtin_return_address(0));
+}
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    preload_free(ptr, __builtin_return_address(0));
+}
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    preload_free(ptr, __builtin_return_address(0));
+}
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    preload_free(ptr, __builtin_return_address(0));
+}
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    preload_free(ptr, __builtin_return_address(0));
+}
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+    preload_free(ptr, __builtin_return_address(0));
+}
+
+
+// Reports
+
+static bool report_wanted(const char* reports, const char* name) {
+    size_t len = strlen(name);
+    for (const char* s = reports; (s = strstr(s, name)); s += len) {
+        if ((s == reports || s[-1] == ',') && (s[len] == ',' || s[len] == '\0')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void preload_report() {
+    const char* reports = getenv("M61_REPORT");
+    if (!reports || !*reports) {
+        return;
+    }
+    // m61's reports print to stdout; send them to stderr
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    if (report_wanted(reports, "stats")) {
+        m61_print_statistics();
+    }
+    if (report_wanted(reports, "hh")) {
+        m61_print_heavy_hitter_report();
+    }
+    if (report_wanted(reports, "hh-json")) {
+        m61_print_heavy_hitter_json();
+    }
+    if (report_wanted(reports, "leaks")) {
+        m61_print_leak_report();
+    }
+    fflush(stdout);
+    if (saved_stdout >= 0) {
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+    }
+}
+
+__attribute__((constructor))
+static void preload_init() {
+    atexit(preload_report);
+}
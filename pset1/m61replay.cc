@@ -0,0 +1,213 @@
+#define M61_DISABLE 1
+#include "m61.hh"
+#include "m61trace.hh"
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// m61replay: Replay an allocation trace recorded with `M61_TRACE=FILE`
+// against m61 or the system allocator, and report speed and memory use.
+
+struct replay_op {
+    uint8_t op;                 // an `m61_trace_op`
+    uint32_t slot;              // index of the block in `ptrs`
+    uint64_t size;
+    const char* file;
+    long line;
+};
+
+// Read `VmHWM` or `VmRSS` from /proc/self/status, in KiB.
+static long proc_status_kb(const char* key) {
+    FILE* f = fopen("/proc/self/status", "r");
+    if (!f) {
+        return -1;
+    }
+    char buf[256];
+    long kb = -1;
+    size_t keylen = strlen(key);
+    while (fgets(buf, sizeof(buf), f)) {
+        if (strncmp(buf, key, keylen) == 0 && buf[keylen] == ':') {
+            kb = strtol(buf + keylen + 1, nullptr, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+// Reset the peak-RSS high water mark, so `VmHWM` measures only the replay.
+static bool reset_peak_rss() {
+    FILE* f = fopen("/proc/self/clear_refs", "w");
+    if (!f) {
+        return false;
+    }
+    bool ok = fputs("5", f) >= 0;
+    return fclose(f) == 0 && ok;
+}
+
+int main(int argc, char** argv) {
+    // don't trace the replay
+    unsetenv("M61_TRACE");
+
+    bool use_system = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "sh")) != -1) {
+        if (opt == 's') {
+            use_system = true;
+        } else {
+            fprintf(opt == 'h' ? stdout : stderr, "Usage: ./m61replay [-s] TRACEFILE\n\
+\n\
+  Replays the allocations and frees in TRACEFILE, which was recorded by\n\
+  running a program with M61_TRACE=TRACEFILE, on one thread. Uses m61, or\n\
+  the system allocator with -s. Reports time per operation, peak RSS, and\n\
+  fragmentation: the fraction of peak RSS growth not used by live blocks.\n");
+            exit(opt == 'h' ? 0 : 1);
+        }
+    }
+    if (optind + 1 != argc) {
+        fprintf(stderr, "Usage: ./m61replay [-s] TRACEFILE\n");
+        exit(1);
+    }
+
+    // map trace file
+    const char* path = argv[optind];
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    void* mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    auto hdr = reinterpret_cast<const m61_trace_header*>(mem);
+    if (mem == MAP_FAILED
+        || size_t(st.st_size) < m61_trace_records_offset
+        || memcmp(hdr->magic, M61_TRACE_MAGIC, sizeof(hdr->magic)) != 0
+        || hdr->version != M61_TRACE_VERSION
+        || hdr->capacity == 0
+        || size_t(st.st_size) < m61_trace_records_offset
+               + hdr->capacity * sizeof(m61_trace_record)) {
+        fprintf(stderr, "%s: not an m61 trace\n", path);
+        exit(1);
+    }
+    auto records = reinterpret_cast<const m61_trace_record*>(
+        reinterpret_cast<const char*>(mem) + m61_trace_records_offset
+    );
+
+    // convert records to operations on numbered slots
+    uint64_t nrecords = hdr->nrecords.load(std::memory_order_relaxed);
+    uint64_t first = nrecords > hdr->capacity ? nrecords - hdr->capacity : 0;
+    std::vector<std::string> files;
+    for (uint32_t i = 0; i != hdr->nfiles && i != m61_trace_max_files; ++i) {
+        files.emplace_back(&hdr->names[hdr->file_offset[i]]);
+    }
+    std::vector<replay_op> ops;
+    ops.reserve(nrecords - first);
+    std::unordered_map<uint64_t, uint32_t> live;
+    std::vector<uint32_t> free_slots;
+    uint32_t nslots = 0;
+    unsigned long long nops[4] = {0, 0, 0, 0};
+    unsigned long long nskipped = 0;
+    int maxthread = 0;
+    for (uint64_t i = first; i != nrecords; ++i) {
+        const m61_trace_record& r = records[i % hdr->capacity];
+        const char* file = r.file < files.size() ? files[r.file].c_str() : "?";
+        maxthread = std::max(maxthread, int(r.thread));
+        if (r.op == m61_trace_malloc || r.op == m61_trace_calloc) {
+            uint32_t slot;
+            if (!free_slots.empty()) {
+                slot = free_slots.back();
+                free_slots.pop_back();
+            } else {
+                slot = nslots++;
+            }
+            live[r.addr] = slot;
+            ops.push_back({r.op, slot, r.size, file, long(r.line)});
+        } else if (r.op == m61_trace_free) {
+            auto it = live.find(r.addr);
+            if (it == live.end()) {
+                // allocated before the ring's oldest record
+                ++nskipped;
+                continue;
+            }
+            ops.push_back({r.op, it->second, 0, file, long(r.line)});
+            free_slots.push_back(it->second);
+            live.erase(it);
+        } else {
+            ++nskipped;
+            continue;
+        }
+        ++nops[r.op];
+    }
+    munmap(mem, st.st_size);
+    live.clear();
+    std::vector<void*> ptrs(nslots, nullptr);
+    std::vector<uint64_t> sizes(nslots, 0);
+
+    // replay
+    long rss_before = proc_status_kb("VmRSS");
+    bool hwm_ok = reset_peak_rss();
+    unsigned long long live_bytes = 0, peak_live_bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const replay_op& o : ops) {
+        if (o.op == m61_trace_free) {
+            if (use_system) {
+                free(ptrs[o.slot]);
+            } else {
+                m61_free(ptrs[o.slot], o.file, o.line);
+            }
+            live_bytes -= sizes[o.slot];
+            continue;
+        }
+        void* ptr;
+        if (o.op == m61_trace_calloc) {
+            ptr = use_system ? calloc(1, o.size) : m61_calloc(1, o.size, o.file, o.line);
+        } else {
+            ptr = use_system ? malloc(o.size) : m61_malloc(o.size, o.file, o.line);
+            // touch every page, as the traced program probably did
+            for (uint64_t off = 0; ptr && off < o.size; off += 4096) {
+                reinterpret_cast<volatile char*>(ptr)[off] = 1;
+            }
+        }
+        ptrs[o.slot] = ptr;
+        sizes[o.slot] = ptr ? o.size : 0;
+        live_bytes += sizes[o.slot];
+        peak_live_bytes = std::max(peak_live_bytes, live_bytes);
+    }
+    std::chrono::duration<double> delta = std::chrono::steady_clock::now() - start;
+
+    long peak_rss = hwm_ok ? proc_status_kb("VmHWM") : -1;
+    if (peak_rss < 0) {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        peak_rss = ru.ru_maxrss;
+    }
+    long rss_growth = peak_rss - rss_before;
+
+    size_t nreplayed = ops.size();
+    printf("trace:         %llu malloc, %llu calloc, %llu free, %d thread%s",
+           nops[m61_trace_malloc], nops[m61_trace_calloc], nops[m61_trace_free],
+           maxthread + 1, maxthread ? "s" : "");
+    if (nskipped) {
+        printf(" (%llu records skipped)", nskipped);
+    }
+    printf("\nallocator:     %s\n", use_system ? "system" : "m61");
+    printf("time:          %.6f s, %.1f ns/op\n", delta.count(),
+           nreplayed ? delta.count() * 1e9 / nreplayed : 0.0);
+    printf("peak live:     %llu bytes\n", peak_live_bytes);
+    printf("peak RSS:      %ld KiB (+%ld KiB during replay)\n", peak_rss, rss_growth);
+    if (rss_growth > 0) {
+        double frag = 1 - double(peak_live_bytes) / (double(rss_growth) * 1024);
+        printf("fragmentation: %.1f%% at peak\n", 100 * (frag > 0 ? frag : 0));
+    }
+}
@@ -0,0 +1,355 @@
+#define M61_DISABLE 1
+#include "m61stack.hh"
+#include "m61.hh"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Stack entries live in one region, reserved on first use, so
+// `m61_stack_is_site` is a range check and an entry's index follows from
+// its address. `stack_buckets` chains entries by hash. An entry is fully
+// written before it is published with a release store, and then never
+// changes except for `name`, so lookups take no lock. `stack_lock`
+// serializes insertions.
+
+struct m61_stack {
+    std::atomic<m61_stack*> next;       // link in hash chain
+    std::atomic<const char*> name;      // symbolized description, or nullptr
+    uint64_t hash;
+    int depth;
+    void* pcs[m61_stack_depth];
+    char text[m61_stack_depth * 19];    // the site's `file` string
+};
+
+static constexpr size_t stack_region_size = size_t(32) << 20;
+static constexpr unsigned stack_nbuckets = 1U << 14;
+
+static std::atomic<m61_stack*> stack_buckets[stack_nbuckets];
+static m61_stack* stacks;
+static std::atomic<size_t> nstacks;
+static std::mutex stack_lock;
+
+static inline uint64_t stack_hash(void* const* pcs, int n) {
+    uint64_t h = n;
+    for (int i = 0; i != n; ++i) {
+        h = (h ^ reinterpret_cast<uintptr_t>(pcs[i])) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+static inline m61_stack* stack_find(m61_stack* s, uint64_t h, void* const* pcs, int n) {
+    for (; s; s = s->next.load(std::memory_order_acquire)) {
+        if (s->hash == h && s->depth == n
+            && memcmp(s->pcs, pcs, n * sizeof(void*)) == 0) {
+            return s;
+        }
+    }
+    return nullptr;
+}
+
+const char* m61_stack_intern(void* const* pcs, int n) {
+    uint64_t h = stack_hash(pcs, n);
+    std::atomic<m61_stack*>& bucket = stack_buckets[h >> 50];
+    if (m61_stack* s = stack_find(bucket.load(std::memory_order_acquire), h, pcs, n)) {
+        return s->text;
+    }
+
+    std::lock_guard<std::mutex> guard(stack_lock);
+    m61_stack* head = bucket.load(std::memory_order_relaxed);
+    if (m61_stack* s = stack_find(head, h, pcs, n)) {
+        return s->text;
+    }
+    if (!stacks) {
+        void* mem = mmap(nullptr, stack_region_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem == MAP_FAILED) {
+            return "?";
+        }
+        stacks = reinterpret_cast<m61_stack*>(mem);
+    }
+    size_t i = nstacks.load(std::memory_order_relaxed);
+    if (i == stack_region_size / sizeof(m61_stack)) {
+        return "?";
+    }
+    m61_stack* s = &stacks[i];
+    s->hash = h;
+    s->depth = n;
+    memcpy(s->pcs, pcs, n * sizeof(void*));
+    char* p = s->text;
+    for (int k = 0; k != n; ++k) {
+        p += sprintf(p, k ? "<%" PRIxPTR : "%#" PRIxPTR,
+                     reinterpret_cast<uintptr_t>(pcs[k]));
+    }
+    s->next.store(head, std::memory_order_relaxed);
+    bucket.store(s, std::memory_order_release);
+    nstacks.store(i + 1, std::memory_order_release);
+    return s->text;
+}
+
+bool m61_stack_is_site(const char* file) {
+    size_t n = nstacks.load(std::memory_order_acquire);
+    auto p = reinterpret_cast<const m61_stack*>(file);
+    return n && p >= stacks && p < stacks + n;
+}
+
+static inline m61_stack* stack_of(const char* file) {
+    size_t i = (file - reinterpret_cast<const char*>(stacks)) / sizeof(m61_stack);
+    return &stacks[i];
+}
+
+const char* m61_stack_name(const char* file) {
+    if (m61_stack_is_site(file)) {
+        if (const char* name = stack_of(file)->name.load(std::memory_order_acquire)) {
+            return name;
+        }
+    }
+    return file;
+}
+
+
+// Symbolization
+//    Return addresses are looked up in the symbol table of the object that
+//    contains them: `.symtab` if the object has one, otherwise `.dynsym`.
+//    Each object's function symbols are read once, sorted by address, and
+//    kept for later reports. Everything here is protected by
+//    `symbolize_lock`, and memory comes from the base allocator.
+
+struct elf_symbol {
+    uintptr_t addr;             // address before relocation
+    size_t size;
+    const char* name;
+};
+
+struct elf_object {
+    elf_object* next;
+    uintptr_t bias;             // load address minus link-time address
+    char* path;                 // as the dynamic linker names it
+    const char* short_name;     // for descriptions
+    elf_symbol* syms;
+    size_t nsyms;
+    void* map;                  // the object file, which holds the names
+    size_t maplen;
+};
+
+static std::mutex symbolize_lock;
+static elf_object* elf_objects;
+
+// load_symbols(o, path)
+//    Read the function symbols of the ELF file at `path` into `o`.
+static void load_symbols(elf_object* o, const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0) {
+        return;
+    } else if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(ElfW(Ehdr))) {
+        close(fd);
+        return;
+    }
+    size_t len = st.st_size;
+    void* map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+    auto data = reinterpret_cast<const char*>(map);
+    auto eh = reinterpret_cast<const ElfW(Ehdr)*>(data);
+    const ElfW(Shdr)* symtab = nullptr;
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0
+        && eh->e_shentsize == sizeof(ElfW(Shdr))
+        && eh->e_shoff < len
+        && eh->e_shnum <= (len - eh->e_shoff) / sizeof(ElfW(Shdr))) {
+        auto sh = reinterpret_cast<const ElfW(Shdr)*>(data + eh->e_shoff);
+        for (unsigned i = 0; i != eh->e_shnum; ++i) {
+            if ((sh[i].sh_type == SHT_SYMTAB
+                 || (sh[i].sh_type == SHT_DYNSYM && !symtab))
+                && sh[i].sh_link < eh->e_shnum
+                && sh[i].sh_offset <= len
+                && sh[i].sh_size <= len - sh[i].sh_offset
+                && sh[sh[i].sh_link].sh_offset <= len
+                && sh[sh[i].sh_link].sh_size <= len - sh[sh[i].sh_link].sh_offset) {
+                symtab = &sh[i];
+            }
+        }
+    }
+    size_t nsyms = 0;
+    if (symtab) {
+        auto sh = reinterpret_cast<const ElfW(Shdr)*>(data + eh->e_shoff);
+        auto syms = reinterpret_cast<const ElfW(Sym)*>(data + symtab->sh_offset);
+        size_t n = symtab->sh_size / sizeof(ElfW(Sym));
+        const char* strs = data + sh[symtab->sh_link].sh_offset;
+        size_t strs_size = sh[symtab->sh_link].sh_size;
+        o->syms = reinterpret_cast<elf_symbol*>(
+            base_malloc((n ? n : 1) * sizeof(elf_symbol))
+        );
+        for (size_t i = 0; o->syms && i != n; ++i) {
+            int type = ELF64_ST_TYPE(syms[i].st_info);
+            if ((type == STT_FUNC || type == STT_GNU_IFUNC)
+                && syms[i].st_shndx != SHN_UNDEF
+                && syms[i].st_value != 0
+                && syms[i].st_name < strs_size
+                && memchr(strs + syms[i].st_name, 0, strs_size - syms[i].st_name)) {
+                o->syms[nsyms++] = {uintptr_t(syms[i].st_value),
+                                    size_t(syms[i].st_size),
+                                    strs + syms[i].st_name};
+            }
+        }
+    }
+    if (nsyms == 0) {
+        base_free(o->syms);
+        o->syms = nullptr;
+        munmap(map, len);
+        return;
+    }
+    std::sort(o->syms, o->syms + nsyms, [] (const elf_symbol& a, const elf_symbol& b) {
+        return a.addr < b.addr;
+    });
+    o->nsyms = nsyms;
+    o->map = map;
+    o->maplen = len;
+}
+
+namespace {
+struct find_object_arg {
+    uintptr_t pc;
+    uintptr_t bias;
+    const char* name;
+};
+}
+
+static int find_object_callback(dl_phdr_info* info, size_t, void* arg) {
+    auto a = reinterpret_cast<find_object_arg*>(arg);
+    for (int i = 0; i != info->dlpi_phnum; ++i) {
+        const ElfW(Phdr)& ph = info->dlpi_phdr[i];
+        if (ph.p_type == PT_LOAD
+            && a->pc - (info->dlpi_addr + ph.p_vaddr) < ph.p_memsz) {
+            a->bias = info->dlpi_addr;
+            a->name = info->dlpi_name ? info->dlpi_name : "";
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// object_for(pc)
+//    Return the loaded object containing `pc`, or nullptr if none does.
+static elf_object* object_for(uintptr_t pc) {
+    find_object_arg a = {pc, 0, nullptr};
+    if (!dl_iterate_phdr(find_object_callback, &a)) {
+        return nullptr;
+    }
+    for (elf_object* o = elf_objects; o; o = o->next) {
+        if (o->bias == a.bias && strcmp(o->path, a.name) == 0) {
+            return o;
+        }
+    }
+    auto o = reinterpret_cast<elf_object*>(base_malloc(sizeof(elf_object)));
+    size_t namelen = strlen(a.name);
+    char* path = reinterpret_cast<char*>(base_malloc(namelen + 1));
+    if (!o || !path) {
+        base_free(o);
+        base_free(path);
+        return nullptr;
+    }
+    memset(o, 0, sizeof(*o));
+    memcpy(path, a.name, namelen + 1);
+    o->path = path;
+    o->bias = a.bias;
+    // the main program has an empty name
+    if (path[0]) {
+        const char* slash = strrchr(path, '/');
+        o->short_name = slash ? slash + 1 : path;
+        load_symbols(o, path);
+    } else {
+        o->short_name = program_invocation_short_name;
+        load_symbols(o, "/proc/self/exe");
+    }
+    o->next = elf_objects;
+    elf_objects = o;
+    return o;
+}
+
+// symbolize_pc(pc, buf, size)
+//    Write a description of return address `pc` to `buf`: its function and
+//    offset, if known, and its object.
+static void symbolize_pc(uintptr_t pc, char* buf, size_t size) {
+    elf_object* o = object_for(pc);
+    if (!o) {
+        snprintf(buf, size, "%#" PRIxPTR, pc);
+        return;
+    }
+    // `pc - 1` is in the call instruction, even if the call never returns
+    // and `pc` is past the end of the function
+    uintptr_t addr = pc - o->bias;
+    const elf_symbol* sym = std::upper_bound(
+        o->syms, o->syms + o->nsyms, addr - 1,
+        [] (uintptr_t a, const elf_symbol& s) {
+            return a < s.addr;
+        }
+    );
+    if (sym != o->syms && (sym[-1].size == 0 || addr - 1 - sym[-1].addr < sym[-1].size)) {
+        snprintf(buf, size, "%s+%#" PRIxPTR " (%s)",
+                 sym[-1].name, addr - sym[-1].addr, o->short_name);
+    } else {
+        snprintf(buf, size, "%s+%#" PRIxPTR, o->short_name, addr);
+    }
+}
+
+static void symbolize_stack(m61_stack* s) {
+    char buf[m61_stack_depth * 256];
+    size_t len = 0;
+    for (int k = 0; k != s->depth; ++k) {
+        if (k) {
+            snprintf(buf + len, sizeof(buf) - len, " <- ");
+            len += strlen(buf + len);
+        }
+        symbolize_pc(reinterpret_cast<uintptr_t>(s->pcs[k]), buf + len, sizeof(buf) - len);
+        len += strlen(buf + len);
+    }
+    char* name = reinterpret_cast<char*>(base_malloc(len + 1));
+    if (name) {
+        memcpy(name, buf, len + 1);
+        s->name.store(name, std::memory_order_release);
+    }
+}
+
+const char* m61_stack_symbolize(const char* file) {
+    if (m61_stack_is_site(file)) {
+        m61_stack* s = stack_of(file);
+        std::lock_guard<std::mutex> guard(symbolize_lock);
+        if (!s->name.load(std::memory_order_relaxed)) {
+            symbolize_stack(s);
+        }
+    }
+    return m61_stack_name(file);
+}
+
+void m61_stack_fork_lock() {
+    symbolize_lock.lock();
+    stack_lock.lock();
+}
+
+void m61_stack_fork_unlock() {
+    stack_lock.unlock();
+    symbolize_lock.unlock();
+}
+
+void m61_stack_symbolize_all() {
+    size_t n = nstacks.load(std::memory_order_acquire);
+    std::lock_guard<std::mutex> guard(symbolize_lock);
+    for (size_t i = 0; i != n; ++i) {
+        if (!stacks[i].name.load(std::memory_order_relaxed)) {
+            symbolize_stack(&stacks[i]);
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef M61STACK_HH
+#define M61STACK_HH 1
+#include <cstddef>
+
+// Stack sites
+//    A *stack site* names an allocation site by a short call stack rather
+//    than a `__FILE__` and `__LINE__`, for callers that have only return
+//    addresses, such as libm61.so. Stacks are hash-consed: equal stacks
+//    share one table entry, and the entry's text is the site's `file`
+//    string, so two allocations come from the same stack site exactly
+//    when their `file` pointers are equal. The text holds the raw return
+//    addresses; symbol names are looked up only when a report asks, from
+//    the ELF symbol tables of the program and its shared libraries.
+
+static constexpr int m61_stack_depth = 6;
+
+// Return the site for the `n <= m61_stack_depth` return addresses in
+// `pcs`, innermost first. Lock-free unless the stack is new.
+const char* m61_stack_intern(void* const* pcs, int n);
+
+// Return true if `file` was returned by `m61_stack_intern`.
+bool m61_stack_is_site(const char* file);
+
+// Symbolize stack site `file`, if it is one and has not been symbolized,
+// and return `m61_stack_name(file)`. Symbolizing takes the dynamic
+// linker's lock, and a thread holding that lock may allocate, so callers
+// must not hold allocator locks.
+const char* m61_stack_symbolize(const char* file);
+
+// Symbolize every stack site. Reports call this before taking allocator
+// locks, then print with `m61_stack_name`.
+void m61_stack_symbolize_all();
+
+// Return the symbolized description of stack site `file`, or `file`
+// itself if it is not a stack site or has not been symbolized.
+const char* m61_stack_name(const char* file);
+
+// Take and release this module's locks around `fork`, so the child never
+// inherits one held by a thread that does not exist there. The allocator's
+// `pthread_atfork` handlers call these first and last.
+void m61_stack_fork_lock();
+void m61_stack_fork_unlock();
+
+#endif
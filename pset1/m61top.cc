@@ -0,0 +1,174 @@
+#define M61_DISABLE 1
+#include "m61.hh"
+#include "m61export.hh"
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <csignal>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// m61top: Watch a running program's allocation rates and heaviest sites,
+// as published by m61 when the program runs with `M61_EXPORT=1`.
+
+
+// Format `n` bytes with a binary unit into `buf`.
+static const char* format_bytes(double n, char* buf, size_t size) {
+    static const char* const units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    int u = 0;
+    while (n >= 1024 && u != 4) {
+        n /= 1024;
+        ++u;
+    }
+    snprintf(buf, size, u ? "%.1f %s" : "%.0f %s", n, units[u]);
+    return buf;
+}
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+// Return the entry for site `name` in `data`, or nullptr.
+static const m61_export_site* find_site(const m61_export_data& data, const char* name) {
+    for (unsigned i = 0; i != data.nsites; ++i) {
+        if (strcmp(data.sites[i].name, name) == 0) {
+            return &data.sites[i];
+        }
+    }
+    return nullptr;
+}
+
+// Print one screen about `cur`, with rates measured since `base`, an
+// earlier publication, if `base` is nonnull.
+static void print_frame(const m61_export_header* hdr, const m61_export_data& cur,
+                        const m61_export_data* base) {
+    char b1[32], b2[32];
+    const m61_statistics& st = cur.stats;
+    uint64_t age = now_ns() - cur.time;
+    printf("m61top: pid %u, published every %.1f s%s\n\n", hdr->pid,
+           hdr->interval / 1e9, age > 3 * hdr->interval ? " (stale)" : "");
+    double secs = base ? (cur.time - base->time) / 1e9 : 0;
+    if (secs > 0) {
+        const m61_statistics& bst = base->stats;
+        printf("allocs/s %12.0f   frees/s %12.0f   bytes/s %12s\n",
+               (st.ntotal - bst.ntotal) / secs,
+               ((st.ntotal - st.nactive) - (bst.ntotal - bst.nactive)) / secs,
+               format_bytes((st.total_size - bst.total_size) / secs, b1, sizeof(b1)));
+    } else {
+        printf("allocs/s %12s   frees/s %12s   bytes/s %12s\n", "-", "-", "-");
+    }
+    printf("active   %12llu blocks %12s     failed %llu\n",
+           st.nactive, format_bytes(st.active_size, b1, sizeof(b1)), st.nfail);
+    printf("mapped   %12llu blocks %12s     scavenged %s\n\n",
+           st.nmapped, format_bytes(st.mapped_size, b1, sizeof(b1)),
+           format_bytes(st.scavenged_size, b2, sizeof(b2)));
+
+    printf("%12s %12s %12s %6s  %s\n", "BYTES/S", "ALLOCS/S", "BYTES", "%", "SITE");
+    for (unsigned i = 0; i != cur.nsites; ++i) {
+        const m61_export_site& site = cur.sites[i];
+        const m61_export_site* old = secs > 0 ? find_site(*base, site.name) : nullptr;
+        // a site evicted from the table and later readmitted restarts its
+        // counts, so its rates since `base` are unknown
+        if (old && site.size >= old->size && site.count >= old->count) {
+            printf("%12s %12.0f",
+                   format_bytes((site.size - old->size) / secs, b1, sizeof(b1)),
+                   (site.count - old->count) / secs);
+        } else {
+            printf("%12s %12s", "-", "-");
+        }
+        printf(" %12s %5.1f%%  %s\n", format_bytes(site.size, b2, sizeof(b2)),
+               cur.hh_total ? 100.0 * site.size / cur.hh_total : 0.0, site.name);
+    }
+}
+
+static void usage(FILE* f) {
+    fprintf(f, "Usage: ./m61top [-d SECONDS] [-n COUNT] PID\n");
+}
+
+int main(int argc, char** argv) {
+    double delay = 1;
+    long count = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:n:h")) != -1) {
+        if (opt == 'd') {
+            delay = strtod(optarg, nullptr);
+        } else if (opt == 'n') {
+            count = strtol(optarg, nullptr, 0);
+        } else {
+            usage(opt == 'h' ? stdout : stderr);
+            fprintf(opt == 'h' ? stdout : stderr, "\n\
+  Shows the allocation rates, active memory, and heaviest allocation sites\n\
+  of process PID, which must use m61 and run with M61_EXPORT=1, every\n\
+  SECONDS seconds (default 1), COUNT times (default forever). Reading the\n\
+  statistics never blocks or slows the process.\n");
+            exit(opt == 'h' ? 0 : 1);
+        }
+    }
+    if (optind + 1 != argc || delay <= 0) {
+        usage(stderr);
+        exit(1);
+    }
+    int pid = atoi(argv[optind]);
+
+    char name[32];
+    snprintf(name, sizeof(name), "/m61.%d", pid);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "m61top: %s: %s (is process %d running with M61_EXPORT=1?)\n",
+                name, strerror(errno), pid);
+        exit(1);
+    }
+    // a short object would fault when read
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "m61top: %s: %s\n", name, strerror(errno));
+        exit(1);
+    } else if (st.st_size < off_t(sizeof(m61_export_header))) {
+        fprintf(stderr, "m61top: %s: too small for m61 statistics\n", name);
+        exit(1);
+    }
+    void* mem = mmap(nullptr, sizeof(m61_export_header), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        fprintf(stderr, "m61top: %s: %s\n", name, strerror(errno));
+        exit(1);
+    }
+    auto hdr = reinterpret_cast<const m61_export_header*>(mem);
+
+    // `last` is the newest publication seen, `base` the one before it
+    m61_export_data cur, last, base;
+    bool have_last = false, have_base = false;
+    bool tty = isatty(STDOUT_FILENO);
+    timespec ts = {time_t(delay), long((delay - time_t(delay)) * 1e9)};
+    for (long frame = 0; count < 0 || frame < count; ++frame) {
+        if (frame) {
+            nanosleep(&ts, nullptr);
+        }
+        if (kill(pid, 0) != 0 && errno == ESRCH) {
+            fprintf(stderr, "m61top: process %d exited\n", pid);
+            exit(0);
+        }
+        if (m61_export_read(hdr, &cur)
+            && (!have_last || cur.time != last.time)) {
+            base = last;
+            have_base = have_last;
+            last = cur;
+            have_last = true;
+        }
+        if (!have_last) {
+            continue;
+        }
+        if (tty) {
+            printf("\x1b[H\x1b[J");
+        } else if (frame) {
+            printf("\n");
+        }
+        print_frame(hdr, last, have_base ? &base : nullptr);
+        fflush(stdout);
+    }
+}
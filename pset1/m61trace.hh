@@ -0,0 +1,60 @@
+#ifndef M61TRACE_HH
+#define M61TRACE_HH 1
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// m61 trace files
+//    With `M61_TRACE=FILE`, m61 records every allocation and free in FILE,
+//    which `m61replay` can replay later. `%p` in FILE stands for the
+//    process ID. A file being written by a live process is not reused.
+//
+//    A trace file is an `m61_trace_header` followed, at offset
+//    `m61_trace_records_offset`, by a ring of `capacity` fixed-size
+//    records. Record number `i` lives in slot `i % capacity`, so once the
+//    ring is full, new records overwrite the oldest ones. The newest
+//    record is number `nrecords - 1`.
+//
+//    Records are ordered: an allocation is recorded after it happens, and
+//    a free before it happens, so an address is never live twice at once
+//    in a trace, even for multithreaded programs.
+
+#define M61_TRACE_MAGIC "M61TRACE"
+#define M61_TRACE_VERSION 1
+
+static constexpr unsigned m61_trace_max_files = 1024;
+static constexpr size_t m61_trace_names_size = 56 * 1024;
+static constexpr size_t m61_trace_records_offset = 65536;
+static constexpr uint16_t m61_trace_nofile = 0xFFFF;
+
+enum m61_trace_op : uint8_t {
+    m61_trace_malloc = 1,
+    m61_trace_calloc = 2,
+    m61_trace_free = 3
+};
+
+struct m61_trace_record {
+    uint64_t time;              // ns since the trace started
+    uint64_t addr;              // block address; names the block until freed
+    uint64_t size;              // requested size (0 for frees)
+    uint32_t line;              // site line
+    uint16_t file;              // site file, an index into the file table
+    uint8_t op;                 // an `m61_trace_op`
+    uint8_t thread;             // recording thread number, mod 256
+};
+static_assert(sizeof(m61_trace_record) == 32, "trace records are 32 bytes");
+
+struct m61_trace_header {
+    char magic[8];              // `M61_TRACE_MAGIC`
+    uint32_t version;           // `M61_TRACE_VERSION`
+    uint32_t nfiles;            // # entries in `file_offset`
+    uint64_t capacity;          // # record slots in the ring
+    std::atomic<uint64_t> nrecords;     // # records ever written
+    uint32_t names_used;        // # bytes used in `names`
+    uint32_t file_offset[m61_trace_max_files];  // file name offsets in `names`
+    char names[m61_trace_names_size];   // null-terminated file names
+};
+static_assert(sizeof(m61_trace_header) <= m61_trace_records_offset,
+              "trace header fits before the records");
+
+#endif
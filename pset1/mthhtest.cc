@@ -0,0 +1,132 @@
+#include "m61.hh"
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#define NALLOCATORS 40
+// mthhtest: Multithreaded variant of hhtest. Runs hhtest's allocation
+// phases on 1, 2, ..., N threads at once and reports throughput.
+
+// Each thread has its own most-recent allocation.
+thread_local void* ptr = nullptr;
+
+// 40 different allocation functions, defined in 3 files,
+// for 40 different call sites
+#include "hhtest-tinyalloc.cc"
+#include "hhtest-smallalloc.cc"
+#include "hhtest-largealloc.cc"
+
+// An array of allocation functions
+void (*allocators[])() = {
+    &tiny1, &tiny2, &tiny3, &tiny4, &tiny5,
+    &tiny6, &tiny7, &tiny8, &tiny9, &tiny10,
+    &tiny11, &tiny12, &tiny13, &tiny14, &tiny15,
+    &tiny16, &tiny17, &tiny18, &tiny19, &tiny20,
+    &small1, &small2, &small3, &small4, &small5,
+    &small6, &small7, &small8, &small9, &small10,
+    &medium1, &medium2, &medium3, &medium4, &medium5,
+    &large1, &large2, &large3, &large4, &large5
+};
+
+struct phase_spec {
+    double skew;
+    unsigned long long count;
+};
+
+// Same distribution as hhtest's `phase`, but each thread draws from its
+// own random number generator (`random()` takes a global lock).
+static void phase(double skew, unsigned long long count, unsigned seed) {
+    double sum_p = 0;
+    for (int i = 0; i < NALLOCATORS; ++i) {
+        sum_p += pow(0.5, i * skew);
+    }
+    unsigned long limit[NALLOCATORS];
+    double ppos = 0;
+    for (int i = 0; i < NALLOCATORS; ++i) {
+        ppos += pow(0.5, i * skew);
+        limit[i] = 0xFFFFFFFFUL * (ppos / sum_p);
+    }
+
+    std::minstd_rand randomness(seed);
+    for (unsigned long long i = 0; i < count; ++i) {
+        unsigned long x = (randomness() << 1) ^ randomness();
+        x &= 0xFFFFFFFFUL;
+        int r = 0;
+        while (r < NALLOCATORS - 1 && x > limit[r]) {
+            ++r;
+        }
+        allocators[r]();
+    }
+}
+
+static void thread_main(const std::vector<phase_spec>* phases, unsigned seed) {
+    for (auto& p : *phases) {
+        phase(p.skew, p.count, seed);
+    }
+    free(ptr);
+    ptr = nullptr;
+}
+
+int main(int argc, char** argv) {
+    base_allocator_disable(1);
+
+    int maxthreads = std::thread::hardware_concurrency();
+    int opt;
+    while ((opt = getopt(argc, argv, "t:h")) != -1) {
+        if (opt == 't') {
+            maxthreads = strtol(optarg, nullptr, 0);
+        } else {
+            printf("Usage: ./mthhtest [-t MAXTHREADS] [SKEW [COUNT]]...\n\
+\n\
+  Runs hhtest phases (see ./hhtest -h) on 1, 2, ..., MAXTHREADS threads,\n\
+  doubling each time. Every thread runs every phase. Reports allocations\n\
+  per second; each allocation is also paired with one free.\n");
+            exit(opt == 'h' ? 0 : 1);
+        }
+    }
+    if (maxthreads < 1) {
+        maxthreads = 1;
+    }
+
+    std::vector<phase_spec> phases;
+    for (int position = optind; position == optind || position < argc; position += 2) {
+        phase_spec p = {0, 1000000};
+        if (position < argc) {
+            p.skew = strtod(argv[position], 0);
+        }
+        if (position + 1 < argc) {
+            p.count = strtoull(argv[position + 1], 0, 0);
+        }
+        phases.push_back(p);
+    }
+    unsigned long long per_thread = 0;
+    for (auto& p : phases) {
+        per_thread += p.count;
+    }
+
+    std::vector<int> thread_counts;
+    for (int n = 1; n < maxthreads; n *= 2) {
+        thread_counts.push_back(n);
+    }
+    thread_counts.push_back(maxthreads);
+
+    for (int nthreads : thread_counts) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int i = 0; i != nthreads; ++i) {
+            threads.emplace_back(thread_main, &phases, 1 + i);
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        std::chrono::duration<double> delta = std::chrono::steady_clock::now() - start;
+        double nallocs = double(per_thread) * nthreads;
+        printf("threads %3d: %12.0f allocs/sec  %8.2f ns/alloc/thread\n",
+               nthreads, nallocs / delta.count(),
+               delta.count() * 1e9 / per_thread);
+    }
+}
@@ -0,0 +1,45 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <vector>
+// Arena allocations count in statistics, appear in leak reports, and are
+// freed all at once by `m61_arena_reset`.
+
+int main() {
+    m61_arena* arena = m61_arena_create();
+    for (int i = 0; i != 1000; ++i) {
+        char* p = (char*) m61_arena_alloc(arena, 1 + i % 50, __FILE__, __LINE__);
+        assert(((uintptr_t) p & 15) == 0);
+        memset(p, i, 1 + i % 50);
+    }
+    m61_print_statistics();
+    m61_arena_reset(arena);
+
+    {
+        m61_arena_allocator<int> allocator(arena);
+        std::vector<int, m61_arena_allocator<int>> v(allocator);
+        for (int i = 0; i != 1000; ++i) {
+            v.push_back(i);
+        }
+        assert(v[999] == 999);
+    }
+    m61_arena_reset(arena);
+
+    void* p = m61_arena_alloc(arena, 33, __FILE__, __LINE__);
+    m61_print_statistics();
+    printf("EXPECTED LEAK: %p with size 33\n", p);
+    m61_print_leak_report();
+    m61_arena_destroy(arena);
+    m61_print_statistics();
+    m61_print_leak_report();
+}
+
+//! alloc count: active       1000   total       1000   fail          0
+//! alloc size:  active      25500   total      25500   fail          0
+//! alloc count: active          1   total    ???   fail          0
+//! alloc size:  active         33   total    ???   fail          0
+//! EXPECTED LEAK: ??{0x\w*}=ptr?? with size 33
+//! LEAK CHECK: test???.cc:29: allocated object ??ptr?? with size 33
+//! alloc count: active          0   total    ???   fail          0
+//! alloc size:  active          0   total    ???   fail          0
@@ -0,0 +1,50 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <vector>
+// Heap snapshots summarize active blocks by site, and a diff reports the
+// sites that grew.
+
+static void* alloc_small() {
+    return malloc(24);
+}
+static void* alloc_big(size_t sz) {
+    return malloc(sz);
+}
+
+int main() {
+    std::vector<void*> ptrs;
+    for (int i = 0; i != 100; ++i) {
+        ptrs.push_back(alloc_small());
+    }
+    void* gone = alloc_big(5000);
+    m61_heap_snapshot* a = m61_snapshot();
+    assert(a && a->count == 100 + 1 && a->nsites == 2);
+
+    for (int i = 0; i != 10; ++i) {
+        ptrs.push_back(alloc_small());
+    }
+    for (int i = 0; i != 50; ++i) {
+        ptrs.push_back(alloc_big(1000));
+    }
+    ptrs.push_back(alloc_big(3000));
+    free(gone);
+    m61_heap_snapshot* b = m61_snapshot();
+    assert(b && b->size == 110 * 24 + 50 * 1000 + 3000);
+    m61_snapshot_diff(a, b);
+    m61_snapshot_free(a);
+    m61_snapshot_free(b);
+
+    for (void* p : ptrs) {
+        free(p);
+    }
+    m61_print_statistics();
+}
+
+//! SNAPSHOT DIFF: total +48240 bytes in +60 objects
+//! SNAPSHOT DIFF: test???.cc:12: +48000 bytes in +50 objects (now 53000 bytes in 51 objects)
+//!     sizes: 512-1023:+50 2048-4095:+1 4096-8191:-1
+//! SNAPSHOT DIFF: test???.cc:9: +240 bytes in +10 objects (now 2640 bytes in 110 objects)
+//!     sizes: 16-31:+10
+//! alloc count: active          0   total        162   fail          0
+//! alloc size:  active          0   total      60640   fail          0
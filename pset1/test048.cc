@@ -0,0 +1,31 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+// Stack sites name allocations by their call stacks, which reports print
+// as symbolized frames.
+
+extern "C" __attribute__((noinline)) void* stack_malloc(size_t sz) {
+    void* ptr = m61_malloc(sz, m61_stack_site(__builtin_return_address(0),
+                                              __builtin_frame_address(0)), 0);
+    asm volatile("" : : : "memory");    // not a tail call
+    return ptr;
+}
+
+extern "C" __attribute__((noinline)) void* make_widget() {
+    void* ptr = stack_malloc(24);
+    memset(ptr, 0, 24);
+    return ptr;
+}
+
+int main() {
+    void* ptr = make_widget();
+    printf("EXPECTED LEAK: %p with size 24\n", ptr);
+    m61_print_leak_report();
+    m61_free(ptr, __FILE__, __LINE__);
+    m61_print_statistics();
+}
+
+//! EXPECTED LEAK: ??{0x\w*}=ptr?? with size 24
+//! LEAK CHECK: make_widget+0x??{[0-9a-f]+}?? (test048) <- main+0x??{[0-9a-f]+}?? (test048)???: allocated object ??ptr?? with size 24
+//! alloc count: active          0   total          1   fail          0
+//! alloc size:  active          0   total         24   fail          0
@@ -0,0 +1,55 @@
+#include "m61.hh"
+#include "m61export.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+// With `M61_EXPORT=1`, statistics and heavy hitters are published in
+// shared memory, where another process can read them.
+
+int main() {
+    setenv("M61_EXPORT", "1", 1);
+    setenv("M61_EXPORT_MS", "5", 1);
+    void* ptrs[100];
+    for (int i = 0; i != 100; ++i) {
+        ptrs[i] = malloc(32);
+    }
+    for (int i = 0; i != 50; ++i) {
+        free(ptrs[i]);
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "/m61.%d", int(getpid()));
+    int fd = shm_open(name, O_RDONLY, 0);
+    assert(fd >= 0);
+    void* mem = mmap(nullptr, sizeof(m61_export_header), PROT_READ, MAP_SHARED, fd, 0);
+    assert(mem != MAP_FAILED);
+    close(fd);
+    auto hdr = reinterpret_cast<const m61_export_header*>(mem);
+
+    // wait for a publication that includes the frees
+    m61_export_data data;
+    for (int tries = 0; tries != 5000; ++tries) {
+        if (m61_export_read(hdr, &data) && data.stats.nactive == 50) {
+            break;
+        }
+        usleep(1000);
+    }
+    printf("pid %s, %llu active, %llu bytes, %llu total\n",
+           hdr->pid == unsigned(getpid()) ? "ok" : "wrong",
+           data.stats.nactive, data.stats.active_size, data.stats.ntotal);
+    for (unsigned i = 0; i != data.nsites; ++i) {
+        printf("site %s: %llu allocations, %llu bytes\n", data.sites[i].name,
+               (unsigned long long) data.sites[i].count,
+               (unsigned long long) data.sites[i].size);
+    }
+
+    for (int i = 50; i != 100; ++i) {
+        free(ptrs[i]);
+    }
+}
+
+//! pid ok, 50 active, 1600 bytes, 100 total
+//! site test049.cc:17: 100 allocations, 3200 bytes
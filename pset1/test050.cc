@@ -0,0 +1,39 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+// `m61_get_heap_stats` and `m61_print_heap_map` report how heap pages
+// are used and how fragmented the free space is.
+
+int main() {
+    void* ptrs[256];
+    for (int i = 0; i != 256; ++i) {
+        ptrs[i] = malloc(48);
+    }
+    void* big = malloc(40000);
+    for (int i = 0; i != 256; i += 4) {
+        free(ptrs[i]);
+    }
+
+    m61_heap_stats stats;
+    m61_get_heap_stats(&stats);
+    assert(stats.heap_size == stats.slab_size + stats.large_size + stats.free_size);
+    assert(stats.active_size == 192 * 48 + 40000);
+    assert(stats.nfree_spans == 1 && stats.free_span_fragmentation == 0);
+    m61_print_heap_map();
+
+    for (int i = 1; i != 256; ++i) {
+        if (i % 4 != 0) {
+            free(ptrs[i]);
+        }
+    }
+    free(big);
+}
+
+//! HEAP: 1048576 bytes: 32768 in slabs, 40960 large, 0 arenas, 974848 free in 1 spans (0 released)
+//! HEAP: 49216 bytes active; largest free span 974848 bytes; fragmentation: free-span 0.0%, external 94.9%
+//! CLASS    64: 2 slabs, 192 of 512 objects active, 28.1% of slab bytes used
+//! MAP: 1 page per character
+//! ??{0x[0-9a-f]+}??  77770000LLLLLLLLLL..............................................
+//! ??{0x[0-9a-f]+}??  ................................................................
+//! ??{0x[0-9a-f]+}??  ................................................................
+//! ??{0x[0-9a-f]+}??  ................................................................
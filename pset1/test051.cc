@@ -0,0 +1,43 @@
+#include "m61.hh"
+#include <cstdio>
+#include <atomic>
+#include <thread>
+// When two threads free a block at the same moment, exactly one free
+// succeeds; the other is a double free.
+
+static constexpr int nrounds = 500;
+static std::atomic<void*> block;
+static std::atomic<int> arrived;
+static std::atomic<int> finished;
+
+// Wait until both threads have arrived `n` times.
+static void rendezvous(int n) {
+    arrived.fetch_add(1);
+    while (arrived.load() < 2 * n) {
+    }
+}
+
+int main() {
+    std::thread other([] () {
+        for (int r = 1; r <= nrounds; ++r) {
+            rendezvous(2 * r - 1);
+            rendezvous(2 * r);
+            free(block.load());
+            finished.store(r);
+        }
+    });
+    for (int r = 1; r <= nrounds; ++r) {
+        rendezvous(2 * r - 1);
+        block.store(malloc(32));
+        rendezvous(2 * r);
+        free(block.load());
+        while (finished.load() != r) {
+        }
+    }
+    other.join();
+    m61_print_statistics();
+}
+
+//! ???
+//! alloc count: active          0   total        500   fail          0
+//! alloc size:  active          0   total      16000   fail          0
@@ -0,0 +1,39 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <set>
+// `m61_malloc_batch` and `m61_free_batch` allocate and free many blocks at
+// once, with statistics, leak reports, and checks as for single calls.
+
+int main() {
+    void* ptrs[100];
+    size_t n = m61_malloc_batch(40, 100, ptrs, __FILE__, __LINE__);
+    assert(n == 100);
+    std::set<void*> distinct(ptrs, ptrs + n);
+    assert(distinct.size() == 100);
+    for (size_t i = 0; i != n; ++i) {
+        assert(((uintptr_t) ptrs[i] & 15) == 0);
+        memset(ptrs[i], int(i), 40);
+    }
+    void* big[2];
+    n = m61_malloc_batch(100000, 2, big, __FILE__, __LINE__);
+    assert(n == 2);
+    m61_print_statistics();
+
+    m61_free_batch(ptrs + 2, 98, __FILE__, __LINE__);
+    m61_free_batch(big + 1, 1, __FILE__, __LINE__);
+    m61_print_statistics();
+    fflush(stdout);
+    m61_free_batch(ptrs + 50, 1, __FILE__, __LINE__);
+    m61_print_leak_report();
+}
+
+//! alloc count: active        102   total        102   fail          0
+//! alloc size:  active     204000   total     204000   fail          0
+//! alloc count: active          3   total        102   fail          0
+//! alloc size:  active     100080   total     204000   fail          0
+//! MEMORY BUG: test052.cc:28: invalid free of pointer ??{0x\w+}??, double free
+//! LEAK CHECK: test052.cc:11: allocated object ??{0x\w+}?? with size 40
+//! LEAK CHECK: test052.cc:11: allocated object ??{0x\w+}?? with size 40
+//! LEAK CHECK: test052.cc:20: allocated object ??{0x\w+}?? with size 100000
@@ -0,0 +1,68 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+// `m61_find_unreachable` reports exactly the blocks that no chain of
+// pointers from the program's data or stack reaches, including cycles, and
+// follows pointers into the middle of blocks. The heap is big enough to be
+// marked by several threads.
+
+struct node {
+    node* next;
+    void* extra;
+    char payload[1000];
+};
+
+static node* head;
+
+__attribute__((noinline)) static void build() {
+    for (int i = 0; i != 4000; ++i) {
+        node* n = (node*) malloc(sizeof(node));
+        n->next = head;
+        n->extra = nullptr;
+        head = n;
+    }
+    head->extra = (char*) malloc(100000) + 5000;
+    char* mapped = (char*) malloc(1 << 20);
+    *(void**) (mapped + 4096) = malloc(77);
+    head->next->extra = mapped;
+
+    node* a = (node*) malloc(sizeof(node));
+    node* b = (node*) malloc(sizeof(node));
+    a->next = b;
+    b->next = a;
+    a->extra = b->extra = nullptr;
+    void* lost = malloc(33);
+    *(void**) lost = malloc(200000);
+}
+
+__attribute__((noinline)) static void clobber_stack() {
+    char buf[16384];
+    memset(buf, 0, sizeof(buf));
+    asm volatile("" : : "r" (buf) : "memory");
+}
+
+int main() {
+    setenv("M61_SCAN_THREADS", "4", 1);
+    build();
+    clobber_stack();
+    size_t n = m61_find_unreachable();
+    printf("%zu unreachable\n", n);
+
+    head->next->extra = nullptr;
+    n = m61_find_unreachable();
+    printf("%zu unreachable\n", n);
+}
+
+//! UNREACHABLE: test053.cc:31: allocated object ??{0x\w+}=b?? with size 1016
+//! UNREACHABLE: test053.cc:30: allocated object ??{0x\w+}=a?? with size 1016
+//! UNREACHABLE: test053.cc:35: allocated object ??{0x\w+}=lost?? with size 33
+//! UNREACHABLE: test053.cc:36: allocated object ??{0x\w+}=big?? with size 200000
+//! 4 unreachable
+//! UNREACHABLE: test053.cc:31: allocated object ??b?? with size 1016
+//! UNREACHABLE: test053.cc:30: allocated object ??a?? with size 1016
+//! UNREACHABLE: test053.cc:27: allocated object ??{0x\w+}=small?? with size 77
+//! UNREACHABLE: test053.cc:35: allocated object ??lost?? with size 33
+//! UNREACHABLE: test053.cc:36: allocated object ??big?? with size 200000
+//! UNREACHABLE: test053.cc:26: allocated object ??{0x\w+}=mapped?? with size 1048576
+//! 6 unreachable
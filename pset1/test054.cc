@@ -0,0 +1,27 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+// A write after free into a quarantined block is reported at the pointer
+// the program freed and the offset into its block, not counting leading
+// redzones or alignment padding.
+
+int main() {
+    setenv("M61_QUARANTINE", "65536", 1);
+    setenv("M61_REDZONE_LEAD", "32", 1);
+    char* small = (char*) aligned_alloc(64, 100);
+    char* large = (char*) malloc(40000);
+    printf("%p %p\n", small, large);
+    fflush(stdout);
+    free(small);
+    free(large);
+    small[5] = 1;
+    large[1000] = 1;
+    // push both blocks out of the quarantine
+    for (int i = 0; i != 64; ++i) {
+        free(malloc(4096));
+    }
+}
+
+//! ??{0x\w+}=small?? ??{0x\w+}=large??
+//! MEMORY BUG: test054.cc:15: detected write after free of pointer ??small??, 5 bytes inside
+//! MEMORY BUG: test054.cc:16: detected write after free of pointer ??large??, 1000 bytes inside
@@ -0,0 +1,82 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// `m61_realloc` resizes in place within a size class, trims and extends
+// large blocks in place, and remaps mapped blocks, preserving contents and
+// counting each resize as a free and an allocation.
+
+static void fill(void* ptr, size_t sz, unsigned char seed) {
+    for (size_t i = 0; i != sz; ++i) {
+        ((unsigned char*) ptr)[i] = (unsigned char) (seed + i * 7);
+    }
+}
+
+static bool check(const void* ptr, size_t sz, unsigned char seed) {
+    for (size_t i = 0; i != sz; ++i) {
+        if (((const unsigned char*) ptr)[i] != (unsigned char) (seed + i * 7)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static unsigned long long large_size() {
+    m61_heap_stats hs;
+    m61_get_heap_stats(&hs);
+    return hs.large_size;
+}
+
+int main() {
+    // within a size class
+    char* p = (char*) malloc(100);
+    fill(p, 100, 1);
+    char* q = (char*) realloc(p, 90);
+    assert(q == p && check(q, 90, 1));
+    q = (char*) realloc(q, 80);
+    assert(q == p && check(q, 80, 1));
+
+    // shrink a large block, then extend it into the pages it gave up
+    char* big = (char*) malloc(200000);
+    fill(big, 200000, 2);
+    unsigned long long before = large_size();
+    char* big2 = (char*) realloc(big, 60000);
+    assert(big2 == big && check(big2, 60000, 2));
+    assert(large_size() < before);
+    big2 = (char*) realloc(big2, 150000);
+    assert(big2 == big && check(big2, 60000, 2));
+    assert(large_size() >= 150000);
+
+    // grow a mapped block with mremap
+    m61_statistics stat;
+    char* mapped = (char*) malloc(1 << 20);
+    fill(mapped, 1 << 20, 3);
+    m61_get_statistics(&stat);
+    assert(stat.nmapped == 1 && stat.mapped_size >= (1 << 20));
+    char* mapped2 = (char*) realloc(mapped, 8 << 20);
+    assert(mapped2 && check(mapped2, 1 << 20, 3));
+    m61_get_statistics(&stat);
+    assert(stat.nmapped == 1 && stat.mapped_size >= (8 << 20));
+    mapped2 = (char*) realloc(mapped2, 512 << 10);
+    assert(mapped2 && check(mapped2, 512 << 10, 3));
+
+    // a block that cannot stay put moves
+    char* r = (char*) realloc(q, 5000);
+    assert(r && check(r, 80, 1));
+
+    // each resize counts as a free and an allocation
+    m61_get_statistics(&stat);
+    assert(stat.nactive == 3);
+    assert(stat.active_size == 5000 + 150000 + (512 << 10));
+    assert(stat.ntotal == 10);
+    assert(stat.total_size == 100 + 90 + 80 + 200000 + 60000 + 150000
+           + (1 << 20) + (8 << 20) + (512 << 10) + 5000);
+
+    free(r);
+    free(big2);
+    free(mapped2);
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total         10   fail          0
+//! alloc size:  active          0   total   10376742   fail          0
@@ -0,0 +1,40 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+// `m61_aligned_alloc` and `m61_posix_memalign` return blocks aligned as
+// requested, and reject alignments that are not powers of two.
+
+int main() {
+    void* ptrs[2][8];
+    int n = 0;
+    for (size_t align = 32; align <= 4096; align *= 2, ++n) {
+        size_t sz = align * 3 / 2 + 5;
+        char* p = (char*) aligned_alloc(align, sz);
+        assert(p && (uintptr_t) p % align == 0);
+        memset(p, 'A', sz);
+        ptrs[0][n] = p;
+
+        void* q = nullptr;
+        int r = posix_memalign(&q, align, 100);
+        assert(r == 0 && q && (uintptr_t) q % align == 0);
+        memset(q, 'B', 100);
+        ptrs[1][n] = q;
+    }
+    for (int i = 0; i != n; ++i) {
+        free(ptrs[0][i]);
+        free(ptrs[1][i]);
+    }
+
+    assert(aligned_alloc(48, 100) == nullptr);
+    void* q = (void*) 1;
+    assert(posix_memalign(&q, 48, 100) == EINVAL && q == (void*) 1);
+    assert(posix_memalign(&q, 4, 100) == EINVAL);
+
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total         16   fail          0
+//! alloc size:  active          0   total      13080   fail          0
@@ -0,0 +1,35 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+// With a leading redzone that is not a multiple of the alignment, aligned
+// blocks free cleanly, and bad frees report the pointer the user holds.
+
+int main() {
+    setenv("M61_REDZONE_LEAD", "48", 1);
+    for (size_t align = 32; align <= 4096; align *= 2) {
+        char* p = (char*) aligned_alloc(align, align + 5);
+        assert(p && (uintptr_t) p % align == 0);
+        memset(p, 'A', align + 5);
+        free(p);
+    }
+
+    void* q = nullptr;
+    int r = posix_memalign(&q, 256, 100);
+    assert(r == 0 && q && (uintptr_t) q % 256 == 0);
+    char* p = (char*) aligned_alloc(64, 100);
+    assert(p && (uintptr_t) p % 64 == 0);
+    printf("%p %p\n", q, p);
+    fflush(stdout);
+    free((char*) q + 16);
+    free(q);
+    p[-1] = 'X';
+    free(p);
+}
+
+//! ??{0x\w+}=q?? ??{0x\w+}=p??
+//! MEMORY BUG: test057.cc:26: invalid free of pointer ???, not allocated
+//!   test057.cc:20: ??? is 16 bytes inside a 100 byte region allocated here
+//! MEMORY BUG: test057.cc:29: detected wild write during free of pointer ??p??
@@ -0,0 +1,35 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstdint>
+// A pointer into the unused tail of a slab, past its last object, is an
+// invalid free, not a reference to a nonexistent object.
+
+int main() {
+    // 32-byte requests plus their 16-byte redzones fill one 4-page slab of
+    // 341 48-byte objects, leaving 16 bytes at the end
+    char* ptrs[341];
+    char* first = nullptr;
+    for (int i = 0; i != 341; ++i) {
+        ptrs[i] = (char*) malloc(32);
+        if (!first || ptrs[i] < first) {
+            first = ptrs[i];
+        }
+    }
+    char* tail = first + 341 * 48 + 8;
+    printf("%p\n", tail);
+    fflush(stdout);
+    assert(m61_usable_size(tail) == 0);
+    free(tail);
+    assert(realloc(tail, 100) == nullptr);
+    for (int i = 0; i != 341; ++i) {
+        free(ptrs[i]);
+    }
+    m61_print_statistics();
+}
+
+//! ??{0x\w+}=tail??
+//! MEMORY BUG: test058.cc:23: invalid free of pointer ??tail??, not allocated
+//! MEMORY BUG: test058.cc:24: invalid free of pointer ??tail??, not allocated
+//! alloc count: active          0   total        341   fail          0
+//! alloc size:  active          0   total      10912   fail          0
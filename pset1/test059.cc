@@ -0,0 +1,62 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+// With `M61_MMAP_THRESHOLD`, a block whose size with redzones reaches the
+// threshold gets its own mapping. Freeing it returns its memory to the OS
+// at once, and its address range is unmapped after 16 more such frees.
+
+// Return the protection of the /proc/self/maps region containing `p`, or
+// "none" if no region contains it.
+static const char* region_perms(void* p) {
+    static char perms[5];
+    uintptr_t addr = (uintptr_t) p;
+    FILE* f = fopen("/proc/self/maps", "r");
+    assert(f);
+    char buf[BUFSIZ];
+    strcpy(perms, "none");
+    while (fgets(buf, sizeof(buf), f)) {
+        unsigned long lo, hi;
+        char pm[5];
+        if (sscanf(buf, "%lx-%lx %4s", &lo, &hi, pm) == 3 && addr >= lo && addr < hi) {
+            strcpy(perms, pm);
+        }
+    }
+    fclose(f);
+    return perms;
+}
+
+int main() {
+    setenv("M61_MMAP_THRESHOLD", "65536", 1);
+    m61_statistics stat;
+
+    // just below the threshold: from the page heap
+    char* small = (char*) malloc(65536 - 17);
+    m61_get_statistics(&stat);
+    assert(stat.nmapped == 0 && stat.mapped_size == 0);
+
+    // at the threshold (the request plus its 16-byte trailing redzone)
+    char* p = (char*) malloc(65536 - 16);
+    memset(p, 'A', 65536 - 16);
+    m61_get_statistics(&stat);
+    assert(stat.nmapped == 1 && stat.mapped_size == 65536);
+    assert(strcmp(region_perms(p), "rw-p") == 0);
+
+    free(p);
+    m61_get_statistics(&stat);
+    assert(stat.nmapped == 0 && stat.mapped_size == 0);
+    assert(strcmp(region_perms(p), "---p") == 0);
+
+    for (int i = 0; i != 16; ++i) {
+        free(malloc(100000));
+    }
+    assert(strcmp(region_perms(p), "none") == 0);
+
+    free(small);
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total         18   fail          0
+//! alloc size:  active          0   total    1731039   fail          0
@@ -0,0 +1,76 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+// With `M61_SCAVENGE_MS`, the pages of a free span that has been idle for
+// that long are released to the OS by a later page heap operation, are
+// counted as scavenged once, and read as zero when reused.
+
+// Return the number of resident pages among the `n` pages at `p`.
+static size_t resident_pages(void* p, size_t n) {
+    unsigned char vec[64];
+    assert(n <= sizeof(vec));
+    int r = mincore(p, n * 4096, vec);
+    assert(r == 0);
+    size_t nres = 0;
+    for (size_t i = 0; i != n; ++i) {
+        nres += vec[i] & 1;
+    }
+    return nres;
+}
+
+int main() {
+    setenv("M61_SCAVENGE_MS", "10", 1);
+    // `guard` keeps `a`'s pages from coalescing with the rest of the heap
+    char* a = (char*) malloc(100000);
+    char* guard = (char*) malloc(100000);
+    memset(a, 'A', 100000);
+    assert((uintptr_t) a % 4096 == 0 && resident_pages(a, 24) == 24);
+    free(a);
+
+    m61_statistics stat;
+    m61_get_statistics(&stat);
+    assert(stat.scavenged_size == 0);
+
+    usleep(50000);
+    // this allocation does not fit in `a`'s span, and scavenges it
+    char* c = (char*) malloc(200000);
+    assert(resident_pages(a, 24) == 0);
+    m61_get_statistics(&stat);
+    assert(stat.scavenged_size >= 100000);
+    m61_heap_stats hs;
+    m61_get_heap_stats(&hs);
+    assert(hs.released_size >= 100000);
+    assert(stat.nactive == 2 && stat.active_size == 300000);
+
+    // a span freed next to released pages does not hide them, and only
+    // its own pages are counted when it is released in turn
+    unsigned long long scavenged = stat.scavenged_size;
+    unsigned long long released = hs.released_size;
+    free(guard);
+    m61_get_heap_stats(&hs);
+    assert(hs.released_size == released);
+    usleep(50000);
+    char* e = (char*) malloc(200000);
+    m61_get_statistics(&stat);
+    assert(stat.scavenged_size == scavenged + 25 * 4096);
+
+    // scavenged pages come back zeroed
+    char* d = (char*) calloc(100000, 1);
+    assert(d == a);
+    for (int i = 0; i != 100000; ++i) {
+        assert(d[i] == 0);
+    }
+
+    free(c);
+    free(e);
+    free(d);
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total          5   fail          0
+//! alloc size:  active          0   total     700000   fail          0
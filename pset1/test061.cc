@@ -0,0 +1,61 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+// With `M61_SAMPLE`, statistics stay exact, per-site estimates from
+// samples fall within 10% of the truth (more than 4 standard deviations
+// at this sampling rate), and the leak report lists the sites of sampled
+// live blocks, but not sites whose blocks were all freed.
+
+static void* ptrs[20000];
+static void* bigs[500];
+
+static bool near(double estimate, double truth) {
+    return estimate >= truth * 0.9 && estimate <= truth * 1.1;
+}
+
+int main() {
+    setenv("M61_SAMPLE", "1024", 1);
+    for (int i = 0; i != 20000; ++i) {
+        free(malloc(100));
+    }
+    for (int i = 0; i != 20000; ++i) {
+        ptrs[i] = malloc(100);
+    }
+    for (int i = 0; i != 500; ++i) {
+        bigs[i] = malloc(4000);
+    }
+
+    m61_statistics stat;
+    m61_get_statistics(&stat);
+    assert(stat.nactive == 20500 && stat.active_size == 4000000);
+    assert(stat.ntotal == 40500 && stat.total_size == 6000000);
+
+    m61_heap_snapshot* snap = m61_snapshot();
+    assert(snap && snap->nsites == 2);
+    assert(snap->sites[0].line == 24 && snap->sites[1].line == 27);
+    assert(near(snap->sites[0].size, 2000000) && near(snap->sites[0].count, 20000));
+    assert(near(snap->sites[1].size, 2000000) && near(snap->sites[1].count, 500));
+    m61_snapshot_free(snap);
+
+    static m61_heavy_hitter_summary hs;
+    m61_get_heavy_hitters(&hs, true);
+    assert(hs.n == 3);
+    for (size_t i = 0; i != hs.n; ++i) {
+        assert(near(hs.hh[i].weight, 2000000));
+    }
+
+    m61_print_leak_report();
+    for (int i = 0; i != 20000; ++i) {
+        free(ptrs[i]);
+    }
+    for (int i = 0; i != 500; ++i) {
+        free(bigs[i]);
+    }
+}
+
+//! LEAK CHECK: test061.cc:24: ~??{\d+}?? bytes in ~??{\d+}?? objects (??{\d+}?? sampled)
+//!     sampled stack: ???
+//! LEAK CHECK: test061.cc:27: ~??{\d+}?? bytes in ~??{\d+}?? objects (??{\d+}?? sampled)
+//!     sampled stack: ???
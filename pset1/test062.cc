@@ -0,0 +1,36 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstdlib>
+#include <unistd.h>
+// With `M61_TRACE`, every allocation and free is recorded, and m61replay
+// reads the trace back with the same operation counts. A realloc records
+// a free and a malloc.
+
+int main() {
+    char path[100];
+    snprintf(path, sizeof(path), "/tmp/m61test062.%d", int(getpid()));
+    setenv("M61_TRACE", "/tmp/m61test062.%p", 1);
+
+    void* ptrs[25];
+    for (int i = 0; i != 20; ++i) {
+        ptrs[i] = malloc(i * 100 + 1);
+    }
+    for (int i = 20; i != 25; ++i) {
+        ptrs[i] = calloc(i, 10);
+    }
+    ptrs[0] = realloc(ptrs[0], 2);
+    for (int i = 0; i != 25; ++i) {
+        free(ptrs[i]);
+    }
+
+    char cmd[200];
+    snprintf(cmd, sizeof(cmd), "./m61replay %s", path);
+    fflush(stdout);
+    int r = system(cmd);
+    assert(r == 0);
+    unlink(path);
+}
+
+//! trace:         21 malloc, 5 calloc, 26 free, 1 thread
+//! ???
@@ -0,0 +1,23 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+// A batch allocation that is the program's first call into m61 sizes its
+// blocks with the configured redzones, so the blocks can be filled and
+// freed without reports.
+
+int main() {
+    setenv("M61_REDZONE_LEAD", "64", 1);
+    void* ptrs[8];
+    size_t n = m61_malloc_batch(40, 8, ptrs, __FILE__, __LINE__);
+    for (size_t i = 0; i != n; ++i) {
+        memset(ptrs[i], 'A' + i, 40);
+    }
+    m61_free_batch(ptrs, n, __FILE__, __LINE__);
+    printf("%zu allocated\n", n);
+    m61_print_statistics();
+}
+
+//! 8 allocated
+//! alloc count: active          0   total          8   fail          0
+//! alloc size:  active          0   total        320   fail          0
@@ -0,0 +1,29 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+// A container that constructs its own `m61_allocator` tags its memory with
+// a location in the standard library; one given an explicitly constructed
+// allocator tags it with the program's location.
+
+static bool in_this_file(const char* file) {
+    return strstr(file, "test064.cc") != nullptr;
+}
+
+int main() {
+    std::vector<int, m61_allocator<int>> dflt;
+    dflt.push_back(1);
+    std::vector<int, m61_allocator<int>> tagged(m61_allocator<int>{});
+    tagged.push_back(2);
+    printf("default-constructed: %s\n",
+           in_this_file(dflt.get_allocator().file()) ? "test064.cc" : "library");
+    printf("explicit: %s:%ld\n", tagged.get_allocator().file(),
+           tagged.get_allocator().line());
+    m61_print_leak_report();
+}
+
+//! default-constructed: library
+//! explicit: test064.cc:16
+//!!UNORDERED
+//! LEAK CHECK: test064.cc:16: allocated object ??{\w+}?? with size 4
+//! LEAK CHECK: ???: allocated object ??{\w+}?? with size 4